@@ -2,9 +2,170 @@
 #include <string>
 #include <vector>
 #include <cctype> // classic character handling functions like toupper()
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <cstdint>
 
 using namespace std;
 
+// Builds a 256-entry case-insensitive lookup table for an alphabet,
+// so validation is one table read per character.
+static array<bool, 256> makeAlphabet(const char* letters) {
+    array<bool, 256> table{};
+    for (const char* p = letters; *p; ++p) {
+        table[static_cast<unsigned char>(*p)] = true;
+        table[static_cast<unsigned char>(tolower(static_cast<unsigned char>(*p)))] = true;
+    }
+    return table;
+}
+
+/* ============================================================
+   SequenceMetrics: thread-safe live-object accounting
+   Every thread updates its own shard (no shared cache lines,
+   no locked instructions); reads lock the shard list and add
+   the shards up, so live counts and bytes are exact.
+   Peaks are tracked from deltas each shard publishes every 64
+   objects or 1 MiB, so a peak can be missed by at most that
+   much per thread.
+   ============================================================ */
+
+class SequenceMetrics {
+public:
+    enum Kind { ALL, GENERIC, DNA, RNA, PROTEIN, KIND_COUNT };
+
+    struct Stats {
+        int64_t live;       // objects alive now
+        int64_t bytes;      // sequence bytes they hold
+        int64_t peakLive;
+        int64_t peakBytes;
+    };
+
+private:
+    static constexpr int64_t FLUSH_OBJECTS = 64;
+    static constexpr int64_t FLUSH_BYTES = int64_t(1) << 20;
+
+    // One per thread. Only the owner writes, so plain load + store
+    // on the atomics is enough; readers just need tear-free values.
+    struct alignas(64) Shard {
+        atomic<int64_t> live[KIND_COUNT] = {};
+        atomic<int64_t> bytes[KIND_COUNT] = {};
+        int64_t pendingLive[KIND_COUNT] = {};
+        int64_t pendingBytes[KIND_COUNT] = {};
+    };
+
+    struct Registry {
+        mutex lock;
+        vector<Shard*> shards;
+        int64_t retiredLive[KIND_COUNT] = {};   // from exited threads
+        int64_t retiredBytes[KIND_COUNT] = {};
+        atomic<int64_t> published[KIND_COUNT] = {};
+        atomic<int64_t> publishedBytes[KIND_COUNT] = {};
+        atomic<int64_t> peakLive[KIND_COUNT] = {};
+        atomic<int64_t> peakBytes[KIND_COUNT] = {};
+    };
+
+    // Never destroyed, so objects outliving main() can still report
+    static Registry& registry() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+
+    // Registers the calling thread's shard on first use and folds
+    // it into the retired totals when the thread exits.
+    struct ShardHandle {
+        Shard* shard = new Shard;
+
+        ShardHandle() {
+            Registry& r = registry();
+            lock_guard<mutex> guard(r.lock);
+            r.shards.push_back(shard);
+        }
+
+        ~ShardHandle() {
+            Registry& r = registry();
+            lock_guard<mutex> guard(r.lock);
+            for (int k = 0; k < KIND_COUNT; ++k) {
+                r.retiredLive[k] += shard->live[k].load(memory_order_relaxed);
+                r.retiredBytes[k] += shard->bytes[k].load(memory_order_relaxed);
+                publish(r, k, shard->pendingLive[k], shard->pendingBytes[k]);
+            }
+            r.shards.erase(find(r.shards.begin(), r.shards.end(), shard));
+            delete shard;
+        }
+    };
+
+    static Shard& local() {
+        thread_local ShardHandle handle;
+        return *handle.shard;
+    }
+
+    static void raise(atomic<int64_t>& peak, int64_t value) {
+        int64_t cur = peak.load(memory_order_relaxed);
+        while (value > cur && !peak.compare_exchange_weak(cur, value, memory_order_relaxed)) {}
+    }
+
+    static void publish(Registry& r, int k, int64_t dLive, int64_t dBytes) {
+        raise(r.peakLive[k], r.published[k].fetch_add(dLive, memory_order_relaxed) + dLive);
+        raise(r.peakBytes[k], r.publishedBytes[k].fetch_add(dBytes, memory_order_relaxed) + dBytes);
+    }
+
+    static void update(int k, int64_t dLive, int64_t dBytes) {
+        Shard& s = local();
+        s.live[k].store(s.live[k].load(memory_order_relaxed) + dLive, memory_order_relaxed);
+        s.bytes[k].store(s.bytes[k].load(memory_order_relaxed) + dBytes, memory_order_relaxed);
+
+        s.pendingLive[k] += dLive;
+        s.pendingBytes[k] += dBytes;
+        if (s.pendingLive[k] >= FLUSH_OBJECTS || s.pendingLive[k] <= -FLUSH_OBJECTS
+            || s.pendingBytes[k] >= FLUSH_BYTES || s.pendingBytes[k] <= -FLUSH_BYTES) {
+            publish(registry(), k, s.pendingLive[k], s.pendingBytes[k]);
+            s.pendingLive[k] = 0;
+            s.pendingBytes[k] = 0;
+        }
+    }
+
+public:
+    // Records one object of kind k (and of ALL) holding `bytes`
+    static void created(Kind k, size_t bytes) {
+        update(ALL, 1, int64_t(bytes));
+        update(k, 1, int64_t(bytes));
+    }
+
+    static void destroyed(Kind k, size_t bytes) {
+        update(ALL, -1, -int64_t(bytes));
+        update(k, -1, -int64_t(bytes));
+    }
+
+    static void resized(Kind k, size_t oldBytes, size_t newBytes) {
+        int64_t d = int64_t(newBytes) - int64_t(oldBytes);
+        update(ALL, 0, d);
+        update(k, 0, d);
+    }
+
+    static Stats read(Kind k) {
+        Registry& r = registry();
+        Stats st{ 0, 0, 0, 0 };
+        {
+            lock_guard<mutex> guard(r.lock);
+            st.live = r.retiredLive[k];
+            st.bytes = r.retiredBytes[k];
+            for (const Shard* s : r.shards) {
+                st.live += s->live[k].load(memory_order_relaxed);
+                st.bytes += s->bytes[k].load(memory_order_relaxed);
+            }
+        }
+        // The exact current value is a lower bound on the peak
+        raise(r.peakLive[k], st.live);
+        raise(r.peakBytes[k], st.bytes);
+        st.peakLive = r.peakLive[k].load(memory_order_relaxed);
+        st.peakBytes = r.peakBytes[k].load(memory_order_relaxed);
+        return st;
+    }
+};
+
+
 /* ============================================================
    BASE CLASS: Sequence
    Contains common data and common functionality.
@@ -14,21 +175,49 @@ using namespace std;
 class Sequence {
 protected:  // protected means derived classes have access,
             // but external users do not.
-    string data;            // The actual biological sequence
-    static int count;       // Counter of active Sequence objects
+    string data;                    // The actual biological sequence
+    SequenceMetrics::Kind kind;     // Which counters this object updates
+
+    // Used by derived classes to say what kind of sequence they are
+    Sequence(const string& d, SequenceMetrics::Kind k)
+        : data(d), kind(k) {
+        SequenceMetrics::created(kind, data.size());
+        cout << "Sequence created. Active sequences: " << getCount() << endl;
+    }
 
 public:
     // Constructor
     Sequence(const string& d)
-        : data(d) {
-        ++count;
-        cout << "Sequence created. Active sequences: " << count << endl;
+        : Sequence(d, SequenceMetrics::GENERIC) {}
+
+    // Copy constructor: copies are live objects too
+    // (e.g. when vector<Isoform> reallocates)
+    Sequence(const Sequence& other)
+        : data(other.data), kind(other.kind) {
+        SequenceMetrics::created(kind, data.size());
+        cout << "Sequence created. Active sequences: " << getCount() << endl;
+    }
+
+    // Assignment keeps the object alive: only its byte count changes,
+    // unless it takes on another kind's counters
+    Sequence& operator=(const Sequence& other) {
+        if (this != &other) {
+            if (kind == other.kind) {
+                SequenceMetrics::resized(kind, data.size(), other.data.size());
+            } else {
+                SequenceMetrics::destroyed(kind, data.size());
+                SequenceMetrics::created(other.kind, other.data.size());
+            }
+            data = other.data;
+            kind = other.kind;
+        }
+        return *this;
     }
 
     // Destructor
     ~Sequence() {
-        --count;
-        cout << "Sequence destroyed. Active sequences: " << count << endl;
+        SequenceMetrics::destroyed(kind, data.size());
+        cout << "Sequence destroyed. Active sequences: " << getCount() << endl;
     }
 
     size_t length() const {
@@ -40,13 +229,19 @@ public:
         cout << "Generic sequence: " << data << endl;
     }
 
+    // Active Sequence objects of every kind
     static int getCount() {
-        return count;
+        return int(SequenceMetrics::read(SequenceMetrics::ALL).live);
     }
-};
 
-// Initialization of static member
-int Sequence::count = 0;
+    static int64_t getBytes() {
+        return SequenceMetrics::read(SequenceMetrics::ALL).bytes;
+    }
+
+    static int64_t getPeakCount() {
+        return SequenceMetrics::read(SequenceMetrics::ALL).peakLive;
+    }
+};
 
 
 /* ============================================================
@@ -58,7 +253,7 @@ public:
     // The base class constructor is ALWAYS called first,
     // before the body of the derived constructor.
     DNASequence(const string& d)
-        : Sequence(d) {
+        : Sequence(d, SequenceMetrics::DNA) {
         cout << "DNASequence created\n";
     }
 
@@ -66,13 +261,18 @@ public:
         cout << "DNASequence destroyed\n";
     }
 
+    // Hides Sequence::getCount(): counts only DNASequence objects
+    static int getCount() {
+        return int(SequenceMetrics::read(SequenceMetrics::DNA).live);
+    }
+
     void describe() const {
         cout << "DNA sequence: " << data << endl;
     }
 
     static bool isValidBase(char c) {
-        char u = toupper(static_cast<unsigned char>(c));
-        return (u=='A' || u=='C' || u=='G' || u=='T');
+        static const array<bool, 256> valid = makeAlphabet("ACGT");
+        return valid[static_cast<unsigned char>(c)];
     }
 
     bool isValid() const {
@@ -91,7 +291,7 @@ public:
 class RNASequence : public Sequence {
 public:
     RNASequence(const string& d)
-        : Sequence(d) {
+        : Sequence(d, SequenceMetrics::RNA) {
         cout << "RNASequence created\n";
     }
 
@@ -99,13 +299,18 @@ public:
         cout << "RNASequence destroyed\n";
     }
 
+    // Hides Sequence::getCount(): counts only RNASequence objects
+    static int getCount() {
+        return int(SequenceMetrics::read(SequenceMetrics::RNA).live);
+    }
+
     void describe() const {
         cout << "RNA sequence: " << data << endl;
     }
 
     static bool isValidBase(char c) {
-        char u = toupper(static_cast<unsigned char>(c));
-        return (u=='A' || u=='C' || u=='G' || u=='U');
+        static const array<bool, 256> valid = makeAlphabet("ACGU");
+        return valid[static_cast<unsigned char>(c)];
     }
 
     bool isValid() const {
@@ -124,7 +329,7 @@ public:
 class ProteinSequence : public Sequence {
 public:
     ProteinSequence(const string& d)
-        : Sequence(d) {
+        : Sequence(d, SequenceMetrics::PROTEIN) {
         cout << "ProteinSequence created\n";
     }
 
@@ -132,14 +337,19 @@ public:
         cout << "ProteinSequence destroyed\n";
     }
 
+    // Hides Sequence::getCount(): counts only ProteinSequence objects
+    static int getCount() {
+        return int(SequenceMetrics::read(SequenceMetrics::PROTEIN).live);
+    }
+
     void describe() const {
         cout << "Protein sequence: " << data << endl;
     }
 
     static bool isValidAA(char c) {
-        const string valid = "ACDEFGHIKLMNPQRSTVWY"; // The 20 amino acids
-        char u = toupper(static_cast<unsigned char>(c));
-        return valid.find(u) != string::npos;
+        // The 20 amino acids, built once instead of per call
+        static const array<bool, 256> valid = makeAlphabet("ACDEFGHIKLMNPQRSTVWY");
+        return valid[static_cast<unsigned char>(c)];
     }
 
     bool isValid() const {
@@ -257,6 +467,11 @@ int main() {
     cout << "Valid? " << (prot.isValid() ? "Yes" : "No") << endl;
 
     cout << "Active sequences now: " << Sequence::getCount() << endl;
+    cout << "  DNA: " << DNASequence::getCount()
+         << ", RNA: " << RNASequence::getCount()
+         << ", Protein: " << ProteinSequence::getCount() << endl;
+    cout << "  Bytes held: " << Sequence::getBytes()
+         << ", peak sequences: " << Sequence::getPeakCount() << endl;
 
 
     cout << "\n--- Gene with Isoforms ---\n";
@@ -0,0 +1,464 @@
+/* ============================================================
+   Lab 5 benchmark suite (Google Benchmark)
+   Covers the Sequence/Isoform/Gene model on synthetic data:
+   construction churn, isValid() throughput per subclass,
+   Gene::addIsoform growth, polymorphic dispatch and describe().
+
+   Build with the top-level CMake project (tracing is compiled
+   out), then track regressions with the JSON report:
+     ./lab5_bench --benchmark_out=lab5_bench.json \
+                  --benchmark_out_format=json
+   or simply `cmake --build <dir> --target bench`.
+   ============================================================ */
+#include "lab5.h"
+
+#include <benchmark/benchmark.h>
+
+/* ============================================================
+   Synthetic data: reproducible reads, proteins, chromosomes
+   and genes. A fixed seed keeps runs comparable.
+   ============================================================ */
+namespace synth {
+
+inline string bases(size_t n, const char* alphabet, mt19937_64& rng) {
+    string s(n, 'A');
+    for (char& c : s) c = alphabet[rng() & 3];
+    return s;
+}
+
+inline string protein(size_t n, mt19937_64& rng) {
+    static const char residues[] = "ACDEFGHIKLMNPQRSTVWY";
+    string s(n, 'A');
+    for (char& c : s) c = residues[rng() % 20];
+    return s;
+}
+
+// Reads of one kind; about 1% carry an N, as in real data
+inline vector<string> reads(size_t count, size_t length, const char* alphabet, uint64_t seed = 42) {
+    mt19937_64 rng(seed);
+    vector<string> out(count);
+    for (string& r : out) {
+        r = bases(length, alphabet, rng);
+        if (rng() % 100 == 0) r[rng() % length] = 'N';
+    }
+    return out;
+}
+
+// Chromosome-scale FASTA body: valid bases wrapped at lineBases per line
+inline string chromosome(size_t length, size_t lineBases = 60, uint64_t seed = 7) {
+    mt19937_64 rng(seed);
+    string s;
+    s.reserve(length + length / lineBases + 1);
+    for (size_t p = 0; p < length; p += lineBases) {
+        s += bases(min(lineBases, length - p), "ACGT", rng);
+        s += '\n';
+    }
+    return s;
+}
+
+// Genes along one chromosome, each with a few isoform transcripts
+inline vector<Gene> genes(size_t count, size_t isoforms, size_t transcriptLength, uint64_t seed = 11) {
+    mt19937_64 rng(seed);
+    vector<Gene> out;
+    out.reserve(count);
+    int pos = 1000;
+    for (size_t g = 0; g < count; ++g) {
+        int len = 2000 + int(rng() % 50000);
+        string id = "G" + to_string(g);
+        out.emplace_back(id, "GENE" + to_string(g), "chr1", pos, pos + len, (rng() & 1) ? '+' : '-');
+        out.back().reserveIsoforms(isoforms);
+        for (size_t k = 0; k < isoforms; ++k)
+            out.back().emplaceIsoform(id + "-" + to_string(201 + k), id + "-T" + to_string(k),
+                                      bases(transcriptLength, "ACGU", rng));
+        pos += len + int(rng() % 10000);
+    }
+    return out;
+}
+
+}  // namespace synth
+
+// Swallows describe() output so only the formatting is timed
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+class CoutSilencer {
+private:
+    NullBuffer sink;
+    streambuf* saved;
+
+public:
+    CoutSilencer() : saved(cout.rdbuf(&sink)) {}
+    ~CoutSilencer() { cout.rdbuf(saved); }
+};
+
+/* ============================================================
+   Construction and destruction churn
+   ============================================================ */
+template <typename T>
+void BM_ConstructDestroy(benchmark::State& state) {
+    size_t length = size_t(state.range(0));
+    vector<string> texts = is_same<T, ProteinSequence>::value
+        ? vector<string>(1, [&] { mt19937_64 rng(3); return synth::protein(length, rng); }())
+        : synth::reads(1, length, is_same<T, RNASequence>::value ? "ACGU" : "ACGT");
+    for (auto _ : state) {
+        T seq(texts[0]);
+        benchmark::DoNotOptimize(&seq);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(length));
+}
+BENCHMARK_TEMPLATE(BM_ConstructDestroy, DNASequence)->Arg(100)->Arg(10000)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_ConstructDestroy, RNASequence)->Arg(100)->Arg(10000)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_ConstructDestroy, ProteinSequence)->Arg(100)->Arg(10000)->Arg(1 << 20);
+
+// A gene with its isoforms built and torn down as a unit
+void BM_GeneChurn(benchmark::State& state) {
+    size_t isoforms = size_t(state.range(0));
+    vector<string> transcripts = synth::reads(isoforms, 2000, "ACGU");
+    for (auto _ : state) {
+        Gene g("ENSG00000141510", "TP53", "chr17", 7661779, 7687550, '-');
+        g.reserveIsoforms(isoforms);
+        for (size_t k = 0; k < isoforms; ++k) g.emplaceIsoform("TP53-2", "TP53-T", transcripts[k]);
+        benchmark::DoNotOptimize(&g);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(isoforms));
+}
+BENCHMARK(BM_GeneChurn)->Arg(1)->Arg(8)->Arg(64);
+
+// Heap-allocated mixed reads, the pattern the demo main() uses
+void BM_HeapChurn(benchmark::State& state) {
+    size_t count = size_t(state.range(0));
+    vector<string> dna = synth::reads(count, 150, "ACGT");
+    vector<string> rna = synth::reads(count, 150, "ACGU", 43);
+    vector<Sequence*> seqs(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; ++i)
+            seqs[i] = (i % 3 == 2) ? static_cast<Sequence*>(new RNASequence(rna[i]))
+                                   : static_cast<Sequence*>(new DNASequence(dna[i]));
+        for (Sequence* s : seqs) delete s;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(count));
+}
+BENCHMARK(BM_HeapChurn)->Arg(1 << 16);
+
+/* ============================================================
+   isValid() throughput per subclass
+   ============================================================ */
+template <typename T>
+void BM_IsValid(benchmark::State& state) {
+    size_t length = size_t(state.range(0));
+    size_t count = max<size_t>(1, (size_t(1) << 24) / length);
+    mt19937_64 rng(5);
+    vector<T> seqs;
+    seqs.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (is_same<T, ProteinSequence>::value) seqs.emplace_back(synth::protein(length, rng));
+        else seqs.emplace_back(synth::bases(length, is_same<T, RNASequence>::value ? "ACGU" : "ACGT", rng));
+    }
+    for (auto _ : state) {
+        size_t valid = 0;
+        for (const T& s : seqs) valid += s.isValid();
+        benchmark::DoNotOptimize(valid);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(count));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(count * length));
+}
+BENCHMARK_TEMPLATE(BM_IsValid, DNASequence)->Arg(150)->Arg(1 << 24);
+BENCHMARK_TEMPLATE(BM_IsValid, RNASequence)->Arg(150)->Arg(1 << 24);
+BENCHMARK_TEMPLATE(BM_IsValid, ProteinSequence)->Arg(150)->Arg(1 << 24);
+
+// A whole chromosome borrowed as a RefView over line-wrapped FASTA text
+void BM_IsValidChromosomeView(benchmark::State& state) {
+    size_t length = size_t(state.range(0));
+    string text = synth::chromosome(length);
+    // A fresh view each time: a view caches its scan result
+    for (auto _ : state) {
+        DNASequence chrom(RefView{ text.data(), 60, 61, 0, length });
+        benchmark::DoNotOptimize(chrom.isValid());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(length));
+}
+BENCHMARK(BM_IsValidChromosomeView)->Arg(1 << 26);
+
+/* ============================================================
+   Variant application: one edit, then composition, hash and
+   validity, on an 8 Mb sequence. Cached properties are patched
+   from the edited window; rescan=1 recomputes them from the
+   packed words as before the cache existed.
+   ============================================================ */
+void BM_EditAndValidate(benchmark::State& state) {
+    bool indels = state.range(0) != 0;
+    bool rescan = state.range(1) != 0;
+    mt19937_64 rng(25);
+    DNASequence seq(synth::bases(size_t(8) << 20, "ACGT", rng));
+    const char* alleles[] = { "A", "C", "G", "T", "AC", "" };
+    for (auto _ : state) {
+        size_t pos = rng() % (seq.length() - 4);
+        if (indels) seq.replace(pos, rng() % 3, alleles[rng() % 6]);
+        else seq.setBase(pos, alleles[rng() % 4][0]);
+
+        if (rescan) {
+            const PackedBases& pb = seq.packed();
+            benchmark::DoNotOptimize(pb.composition(0, pb.size()));
+            benchmark::DoNotOptimize(pb.contentHash(pb.wordTerms(0, pb.packedWords().size()), pb.sideTerms(), pb.size()));
+        } else {
+            benchmark::DoNotOptimize(seq.composition());
+            benchmark::DoNotOptimize(seq.contentHash());
+        }
+        benchmark::DoNotOptimize(seq.isValid());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+BENCHMARK(BM_EditAndValidate)->ArgsProduct({ { 0, 1 }, { 0, 1 } })->ArgNames({ "indels", "rescan" });
+
+/* ============================================================
+   Gene::addIsoform growth, with and without reserveIsoforms()
+   ============================================================ */
+void BM_AddIsoform(benchmark::State& state) {
+    size_t isoforms = size_t(state.range(0));
+    bool reserve = state.range(1) != 0;
+    Isoform iso("ENST00000269305", "TP53-201", synth::reads(1, 1000, "ACGU")[0]);
+    for (auto _ : state) {
+        Gene g("ENSG00000141510", "TP53", "chr17", 7661779, 7687550, '-');
+        if (reserve) g.reserveIsoforms(isoforms);
+        for (size_t k = 0; k < isoforms; ++k) g.addIsoform(iso);
+        benchmark::DoNotOptimize(&g);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(isoforms));
+}
+BENCHMARK(BM_AddIsoform)->ArgsProduct({ { 4, 64, 1024 }, { 0, 1 } })->ArgNames({ "isoforms", "reserve" });
+
+/* ============================================================
+   Isoforms as owned copies vs. exon lists over the gene's shared
+   pre-mRNA: 20 kb gene, 24 exons, each isoform skips a few
+   ============================================================ */
+void BM_BuildIsoforms(benchmark::State& state) {
+    size_t isoforms = size_t(state.range(0));
+    bool spliced = state.range(1) != 0;
+    const int geneStart = 1, geneEnd = 20000;
+    mt19937_64 rng(23);
+    RNASequence pre(synth::bases(geneEnd, "ACGU", rng));
+
+    vector<vector<pair<int, int>>> layouts(isoforms);
+    for (auto& exons : layouts)
+        for (int e = 0; e < 24; ++e)
+            if (rng() % 4 != 0) exons.push_back({ geneStart + e * 800, geneStart + e * 800 + 299 });
+
+    size_t bytes = 0;
+    for (auto _ : state) {
+        Gene g("ENSG00000135679", "MDM2", "chr12", geneStart, geneEnd, '+');
+        g.setPreMRNA(pre);
+        g.reserveIsoforms(isoforms);
+        for (size_t k = 0; k < isoforms; ++k) {
+            string id = "ENST" + to_string(k);
+            if (spliced) {
+                g.addSplicedIsoform(id, id, layouts[k]);
+            } else {
+                string text;
+                for (auto [s, e] : layouts[k]) text += pre.substr(size_t(s - geneStart), size_t(e - s + 1));
+                g.emplaceIsoform(id, id, text);
+            }
+        }
+        bytes = g.memoryUsage();
+        benchmark::DoNotOptimize(&g);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(isoforms));
+    state.counters["gene_bytes"] = double(bytes);
+}
+BENCHMARK(BM_BuildIsoforms)->ArgsProduct({ { 8, 64 }, { 0, 1 } })->ArgNames({ "isoforms", "spliced" });
+
+/* ============================================================
+   Polymorphic dispatch: vector<Sequence*> vs vector<AnySequence>
+   ============================================================ */
+void BM_DispatchVirtual(benchmark::State& state) {
+    size_t count = size_t(state.range(0));
+    vector<string> dna = synth::reads(count, 100, "ACGT");
+    vector<string> rna = synth::reads(count, 100, "ACGU", 43);
+    vector<unique_ptr<Sequence>> owned;
+    vector<Sequence*> seqs;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 3 == 2) owned.push_back(make_unique<RNASequence>(rna[i]));
+        else owned.push_back(make_unique<DNASequence>(dna[i]));
+        seqs.push_back(owned.back().get());
+    }
+    for (auto _ : state) {
+        size_t valid = 0;
+        uint64_t bases = 0;
+        for (const Sequence* s : seqs) {
+            valid += s->isValid();
+            bases += s->length();
+        }
+        benchmark::DoNotOptimize(valid);
+        benchmark::DoNotOptimize(bases);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(count));
+}
+BENCHMARK(BM_DispatchVirtual)->Arg(1 << 12)->Arg(1 << 20);
+
+void BM_DispatchVariant(benchmark::State& state) {
+    size_t count = size_t(state.range(0));
+    vector<string> dna = synth::reads(count, 100, "ACGT");
+    vector<string> rna = synth::reads(count, 100, "ACGU", 43);
+    vector<AnySequence> seqs;
+    seqs.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 3 == 2) seqs.push_back(AnySequence::make<RNASequence>(rna[i]));
+        else seqs.push_back(AnySequence::make<DNASequence>(dna[i]));
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(countValid(seqs));
+        benchmark::DoNotOptimize(totalLength(seqs));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(count));
+}
+BENCHMARK(BM_DispatchVariant)->Arg(1 << 12)->Arg(1 << 20);
+
+/* ============================================================
+   describe() formatting (output discarded)
+   ============================================================ */
+template <typename T>
+void BM_Describe(benchmark::State& state) {
+    mt19937_64 rng(9);
+    T seq(is_same<T, ProteinSequence>::value
+              ? synth::protein(size_t(state.range(0)), rng)
+              : synth::bases(size_t(state.range(0)), is_same<T, RNASequence>::value ? "ACGU" : "ACGT", rng));
+    CoutSilencer quiet;
+    for (auto _ : state) seq.describe();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Describe, DNASequence)->Arg(100)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_Describe, RNASequence)->Arg(100)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_Describe, ProteinSequence)->Arg(100)->Arg(10000);
+
+void BM_DescribeGenes(benchmark::State& state) {
+    vector<Gene> genes = synth::genes(size_t(state.range(0)), 3, 500);
+    CoutSilencer quiet;
+    for (auto _ : state)
+        for (const Gene& g : genes) g.describe();
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(genes.size()));
+}
+BENCHMARK(BM_DescribeGenes)->Arg(1000);
+
+void BM_DescribeGenesSink(benchmark::State& state) {
+    vector<Gene> genes = synth::genes(size_t(state.range(0)), 3, 500);
+    BufferSink out(1 << 20);
+    for (auto _ : state) {
+        out.clear();
+        for (const Gene& g : genes) g.describe(out);
+        benchmark::DoNotOptimize(out.view().data());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(genes.size()));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(out.size()));
+}
+BENCHMARK(BM_DescribeGenesSink)->Arg(1000);
+
+/* ============================================================
+   BED / GTF / FASTA emitters over a genome-scale gene set
+   (60k genes, 3 isoforms each)
+   ============================================================ */
+const vector<Gene>& genomeGenes() {
+    static const vector<Gene> genes = synth::genes(60000, 3, 200);
+    return genes;
+}
+
+template <typename Emit>
+void emitBenchmark(benchmark::State& state, Emit emitAll) {
+    const vector<Gene>& genes = genomeGenes();
+    BufferSink out(1 << 24);
+    for (auto _ : state) {
+        out.clear();
+        emitAll(out, genes);
+        benchmark::DoNotOptimize(out.view().data());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(genes.size()));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(out.size()));
+}
+
+void BM_EmitBED(benchmark::State& state) {
+    emitBenchmark(state, [](OutputSink& out, const vector<Gene>& g) { emit::bed(out, g); });
+}
+void BM_EmitGTF(benchmark::State& state) {
+    emitBenchmark(state, [](OutputSink& out, const vector<Gene>& g) { emit::gtf(out, g); });
+}
+void BM_EmitFASTA(benchmark::State& state) {
+    emitBenchmark(state, [](OutputSink& out, const vector<Gene>& g) { emit::fasta(out, g); });
+}
+BENCHMARK(BM_EmitBED)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EmitGTF)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EmitFASTA)->Unit(benchmark::kMillisecond);
+
+/* ============================================================
+   AnnotationReader on a GENCODE-like GTF: 8000 genes with four
+   transcripts of eight exons each, with and without pulling the
+   sequences from a mapped 64 Mb reference
+   ============================================================ */
+void BM_LoadAnnotation(benchmark::State& state) {
+    bool withReference = state.range(0) != 0;
+    const string fastaPath = "lab5_bench_genome.fa", gtfPath = "lab5_bench_annotation.gtf";
+    const int chromLength = 64000000;
+    size_t fileBytes = 0;
+    {
+        ofstream fa(fastaPath, ios::binary);
+        fa << ">chr1\n" << synth::chromosome(chromLength);
+    }
+    remove((fastaPath + ".fai").c_str());
+    {
+        ReferenceStore ref(fastaPath);
+        mt19937_64 rng(24);
+        vector<Gene> genes;
+        int pos = 1000;
+        for (size_t g = 0; g < 8000; ++g) {
+            int len = 2000 + int(rng() % 6000);
+            if (pos + len > chromLength) break;
+            string id = "ENSG" + to_string(10000000 + g);
+            Gene& gene = genes.emplace_back(id, "GENE" + to_string(g), "chr1", pos, pos + len - 1,
+                                            (rng() & 1) ? '+' : '-');
+            gene.loadPreMRNA(ref);
+            for (int t = 0; t < 4; ++t) {
+                vector<pair<int, int>> exons;
+                for (int e = 0; e < 8; ++e) {
+                    int s = pos + e * (len / 8) + int(rng() % 50);
+                    exons.push_back({ s, s + 100 + int(rng() % 100) });
+                }
+                gene.addSplicedIsoform(id + "-" + to_string(201 + t), "GENE" + to_string(g) + "-T" + to_string(t), exons);
+            }
+            pos += len + int(rng() % 5000);
+        }
+        string text;
+        {
+            StringSink out(text);
+            emit::gtf(out, genes);
+        }
+        ofstream(gtfPath, ios::binary) << text;
+        fileBytes = text.size();
+    }
+
+    ReferenceStore ref(fastaPath);
+    size_t isoforms = 0;
+    for (auto _ : state) {
+        AnnotationReader reader(gtfPath);
+        GeneAnnotation a = reader.load(withReference ? &ref : nullptr);
+        isoforms = 0;
+        for (const Gene& g : a.all()) isoforms += g.isoformCount();
+        benchmark::DoNotOptimize(isoforms);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(isoforms));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(fileBytes));
+    remove(gtfPath.c_str());
+    remove(fastaPath.c_str());
+    remove((fastaPath + ".fai").c_str());
+}
+BENCHMARK(BM_LoadAnnotation)->Arg(0)->Arg(1)->ArgName("reference")->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+    benchmark::AddCustomContext("lab5_kernel", validation::kernelName(validation::activeKernel()));
+    benchmark::AddCustomContext("lab5_trace", to_string(LAB5_TRACE));
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,212 +1,393 @@
-#include <iostream>
-#include <vector>
-#include <string>
-using namespace std;
+#include "lab5.h"
 
 /* ============================================================
-   Abstract Base Class: Sequence
+   Dispatch benchmark: vector<Sequence*> vs vector<AnySequence>
+   over millions of short reads (build with -O2 -DNDEBUG so
+   lifecycle tracing is compiled out)
    ============================================================ */
-class Sequence {
-protected:
-    string data;
-
-public:
-    Sequence(const string& d) : data(d) {
-        cout << "Sequence created\n";
+void benchmarkDispatch(size_t reads, size_t readLength) {
+    mt19937_64 rng(42);
+    // Every third read is RNA; about 1% carry an N
+    vector<string> texts(reads);
+    for (size_t i = 0; i < reads; ++i) {
+        const char* alphabet = (i % 3 == 2) ? "ACGU" : "ACGT";
+        texts[i].resize(readLength);
+        for (char& c : texts[i]) c = alphabet[rng() & 3];
+        if (rng() % 100 == 0) texts[i][rng() % readLength] = 'N';
     }
 
-    virtual ~Sequence() {
-        cout << "Sequence destroyed\n";
-    }
+    auto time = [](auto&& body) {
+        auto t0 = chrono::steady_clock::now();
+        body();
+        return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    };
+
+    cout << "Dispatch benchmark: " << reads << " reads of " << readLength << " bp\n";
 
-    // Pure virtual methods → Sequence becomes abstract
-    virtual void describe() const = 0;
-    virtual bool isValid() const = 0;
+    // Virtual: one heap object per read, called through the vtable
+    {
+        vector<Sequence*> seqs;
+        seqs.reserve(reads);
+        double build = time([&] {
+            for (size_t i = 0; i < reads; ++i)
+                seqs.push_back(i % 3 == 2 ? static_cast<Sequence*>(new RNASequence(texts[i]))
+                                          : static_cast<Sequence*>(new DNASequence(texts[i])));
+        });
+        size_t valid = 0;
+        uint64_t bases = 0;
+        double scan = time([&] {
+            for (const Sequence* s : seqs) {
+                valid += s->isValid();
+                bases += s->length();
+            }
+        });
+        double destroy = time([&] { for (Sequence* s : seqs) delete s; });
+        cout << "  virtual : build " << build << " s, scan " << scan * 1e9 / reads
+             << " ns/read, destroy " << destroy << " s (" << valid << " valid, "
+             << bases << " bases)\n";
+    }
 
-    int length() const {
-        return data.size();
+    // Variant: contiguous by-value storage, statically dispatched visitors
+    {
+        vector<AnySequence> seqs;
+        seqs.reserve(reads);
+        double build = time([&] {
+            for (size_t i = 0; i < reads; ++i) {
+                if (i % 3 == 2) seqs.push_back(AnySequence::make<RNASequence>(texts[i]));
+                else seqs.push_back(AnySequence::make<DNASequence>(texts[i]));
+            }
+        });
+        size_t valid = 0;
+        uint64_t bases = 0;
+        double scan = time([&] {
+            valid = countValid(seqs);
+            bases = totalLength(seqs);
+        });
+        double destroy = time([&] { vector<AnySequence>().swap(seqs); });
+        cout << "  variant : build " << build << " s, scan " << scan * 1e9 / reads
+             << " ns/read, destroy " << destroy << " s (" << valid << " valid, "
+             << bases << " bases)\n";
     }
-};
+}
 
 /* ============================================================
-   Derived Class: DNASequence
+   MAIN
    ============================================================ */
-class DNASequence : public Sequence {
-public:
-    DNASequence(const string& d) : Sequence(d) {
-        cout << "DNASequence created\n";
+int main(int argc, char* argv[]) {
+
+    // ./lab5 --bench-dispatch [reads] [length]
+    if (argc > 1 && string(argv[1]) == "--bench-dispatch") {
+        size_t reads = argc > 2 ? stoul(argv[2]) : 2000000;
+        size_t length = argc > 3 ? stoul(argv[3]) : 100;
+        benchmarkDispatch(reads, max<size_t>(length, 1));
+        return 0;
     }
 
-    ~DNASequence() override {
-        cout << "DNASequence destroyed\n";
+    // Optional FASTA/FASTQ files (plain, or gzip with LAB5_WITH_ZLIB)
+    for (int a = 1; a < argc; ++a) {
+        cout << "--- Streaming " << argv[a] << " ---\n";
+        try {
+            SequenceReader reader(argv[a]);
+            SeqRecord rec;
+            size_t records = 0, bases = 0, longest = 0;
+            while (reader.next(rec)) {
+                ++records;
+                bases += rec.seq.size();
+                longest = max(longest, rec.seq.size());
+            }
+            cout << records << " records, " << bases << " bases, longest "
+                 << longest << ", buffer " << reader.bufferCapacity() << " bytes\n\n";
+        } catch (const exception& e) {
+            cout << "Error: " << e.what() << "\n\n";
+        }
     }
 
-    void describe() const override {
-        cout << "DNA sequence: " << data << endl;
-    }
+    cout << "--- Polymorphic standalone sequences ---\n";
 
-    bool isValid() const override {
-        for (char c : data)
-            if (c!='A' && c!='C' && c!='G' && c!='T')
-                return false;
-        return true;
-    }
-};
+    // Base pointer → points to derived objects
+    Sequence* s1 = new DNASequence("ACGTACGT");
+    Sequence* s2 = new RNASequence("AUGGCCAUGG");
+    Sequence* s3 = new ProteinSequence("MTAPQLR");
 
-/* ============================================================
-   Derived Class: RNASequence
-   ============================================================ */
-class RNASequence : public Sequence {
-public:
-    RNASequence(const string& d) : Sequence(d) {
-        cout << "RNASequence created\n";
-    }
+    vector<Sequence*> seqs = { s1, s2, s3 };
 
-    ~RNASequence() override {
-        cout << "RNASequence destroyed\n";
+    for (Sequence* s : seqs) {
+        s->describe();
+        cout << "Length: " << s->length() << endl;
+        cout << "Valid? " << (s->isValid() ? "Yes" : "No") << endl;
+        cout << endl;
     }
 
-    void describe() const override {
-        cout << "RNA sequence: " << data << endl;
-    }
+    vector<BatchEngine::Result> results = BatchEngine::run(seqs);
+    BatchEngine::Summary summary = BatchEngine::summarize(results);
+    cout << "Batch: " << summary.count[0] << " DNA, " << summary.count[1] << " RNA, "
+         << summary.count[2] << " protein; "
+         << summary.valid[0] + summary.valid[1] + summary.valid[2] << " valid, lengths "
+         << summary.shortest << "-" << summary.longest << endl;
+    cout << "DNA composition (A C G T): " << results[0].composition[0] << " "
+         << results[0].composition[1] << " " << results[0].composition[2] << " "
+         << results[0].composition[3] << endl;
+
+    cout << "Validation kernel: "
+         << validation::kernelName(validation::activeKernel()) << endl;
+    ProteinSequence bad("MTAPQ*LR");
+    cout << "First invalid residue of MTAPQ*LR at offset "
+         << bad.firstInvalid() << endl;
 
-    bool isValid() const override {
-        for (char c : data)
-            if (c!='A' && c!='C' && c!='G' && c!='U')
-                return false;
-        return true;
-    }
-};
+    // Deletion (virtual destructor → correct order)
+    for (Sequence* s : seqs)
+        delete s;
 
-/* ============================================================
-   Derived Class: ProteinSequence
-   ============================================================ */
-class ProteinSequence : public Sequence {
-public:
-    ProteinSequence(const string& d) : Sequence(d) {
-        cout << "ProteinSequence created\n";
-    }
+    cout << "\n--- Arena-allocated batch ---\n";
 
-    ~ProteinSequence() override {
-        cout << "ProteinSequence destroyed\n";
-    }
+    {
+        SequenceArena arena;
+        pmr::vector<Sequence*> batch(arena.allocator());
+        batch.push_back(arena.make<DNASequence>("GATTACA"));
+        batch.push_back(arena.make<RNASequence>("GAUUACA"));
+        batch.push_back(arena.make<ProteinSequence>("MKTAYIAK"));
 
-    void describe() const override {
-        cout << "Protein sequence: " << data << endl;
-    }
+        for (Sequence* s : batch)
+            cout << "Length " << s->length() << ", valid? "
+                 << (s->isValid() ? "Yes" : "No") << endl;
 
-    bool isValid() const override {
-        for (char c : data)
-            if (!isalpha(c))
-                return false;
-        return true;
+        arena.clear();      // whole batch freed at once
     }
-};
 
-/* ============================================================
-   Isoform: contains RNASequence (composition + derived class)
-   ============================================================ */
-class Isoform {
-private:
-    string id;
-    string name;
-    RNASequence rna;
-
-public:
-    Isoform(const string& i, const string& n, const string& seq)
-        : id(i), name(n), rna(seq)
+    cout << "\n--- Packed nucleotide storage ---\n";
+
+    // N runs and soft-masked (lowercase) bases survive the 2-bit packing
+    DNASequence contig("ACGTNNNNNNacgtacgtRYACGT");
+    contig.describe();
+    cout << "Length: " << contig.length() << endl;
+    cout << "Valid? " << (contig.isValid() ? "Yes" : "No") << endl;
+    cout << "Base at 5: " << contig[5] << ", base at 12: " << contig[12] << endl;
+    cout << "Ambiguity runs: " << contig.packed().ambiguityRuns().size()
+         << ", masked runs: " << contig.packed().maskRuns().size() << endl;
+    Composition comp = contig.composition();
+    cout << "GC: " << comp.gc() << ", CpG o/e: " << comp.cpgObservedExpected()
+         << ", other: " << comp.other << endl;
+    cout << "Reverse complement: " << StrandView::reverseComplement(contig).str() << endl;
+    cout << "Transcript: " << StrandView::transcript(contig).str() << endl;
+
+    // Uppercasing reaches lowercase ambiguity codes too: "nN" becomes one N run
+    DNASequence softMasked("acgtnNNrACGT");
+    softMasked.toUpperInPlace();
+    cout << "Uppercased: " << softMasked.str() << ", ambiguity runs: "
+         << softMasked.packed().ambiguityRuns().size() << ", same as typed uppercase: "
+         << (softMasked.contentHash() == DNASequence("ACGTNNNRACGT").contentHash() ? "Yes" : "No") << endl;
+
+    cout << "\n--- Gene with polymorphic Isoforms ---\n";
+
+    Gene g("ENSG000001", "TP53", "chr17", 7668402, 7687550, '-');
+
+    Isoform iso1("ENST0001", "TP53-201", "AUGGCCAUGGCGCCC");
+    Isoform iso2("ENST0002", "TP53-202", "AUGCCUGAUGCUGUAG");
+
+    g.reserveIsoforms(3);
+    g.addIsoform(iso1);
+    g.addIsoform(iso2);
+    g.emplaceIsoform("ENST0003", "TP53-203", "AUGGAGGAGCCGCAGUCA");
+
+    g.describe();
+
+    cout << "\n--- Gene overlap index ---\n";
+
+    GeneAnnotation annotation;
+    annotation.reserve(3);
+    annotation.add(g);
+    annotation.emplace("ENSG000002", "WRAP53", "chr17", 7686071, 7725776, '+');
+    annotation.emplace("ENSG000003", "EFNB3", "chr17", 7705202, 7711387, '+');
+    annotation.build();
+
+    for (const Gene* hit : annotation.overlaps("chr17", 7687000))
+        cout << "chr17:7687000 overlaps " << hit->getName() << endl;
+    for (const Gene* hit : annotation.overlaps("chr17", 7700000, 7710000, '+'))
+        cout << "chr17:7700000-7710000 (+) overlaps " << hit->getName() << endl;
+
     {
-        cout << "Isoform created: " << name << endl;
+        GeneTable table(annotation);
+        GeneTable::Groups byStrand = table.groupByStrand();
+        for (size_t k = 0; k < byStrand.size(); ++k) {
+            const uint32_t* rows = byStrand.rows.data() + byStrand.offsets[k];
+            size_t n = byStrand.offsets[k + 1] - byStrand.offsets[k];
+            cout << "Strand " << char(byStrand.keys[k]) << ": " << n << " genes, "
+                 << table.totalSpan(rows, n) << " bp\n";
+        }
+        for (uint32_t r : table.filterRange("chr17", 7680000, 7690000))
+            cout << "GeneTable row " << r << " in chr17:7680000-7690000: "
+                 << table.nameAt(r).str() << ", " << table.isoforms(r).size() << " isoforms\n";
     }
 
-    ~Isoform() {
-        cout << "Isoform destroyed: " << name << endl;
+    cout << "\n--- Annotation snapshot ---\n";
+
+    try {
+        const string snapshotPath = "lab5_annotation.snap";
+        AnnotationSnapshot::write(snapshotPath, annotation);
+        AnnotationSnapshot snap(snapshotPath);
+        snap.forEachGene([&](const AnnotationSnapshot::GeneRecord& r) {
+            cout << r.id << " " << r.name << " " << r.chrom << ":" << r.start << "-" << r.end
+                 << " (" << r.strand << "), " << r.isoformEnd - r.firstIsoform << " isoforms\n";
+        });
+        if (snap.isoformCount() > 0) {
+            RNASequence first = snap.sequence(0);
+            cout << snap.isoform(0).id << " sequence from snapshot: " << first.str() << endl;
+        }
+        remove(snapshotPath.c_str());
+    } catch (const exception& e) {
+        cout << "Error: " << e.what() << endl;
     }
 
-    void describe() const {
-        cout << "Isoform " << id << " (" << name << ")\n";
-        rna.describe();
-        cout << "Length: " << rna.length() << " bases\n";
-    }
-};
+    cout << "\n--- BED / GTF / FASTA emitters ---\n";
 
-/* ============================================================
-   Gene: contains multiple Isoforms
-   ============================================================ */
-class Gene {
-private:
-    string id;
-    string name;
-    string chrom;
-    int start;
-    int end;
-    char strand;
-
-    vector<Isoform> isoforms;
-
-public:
-    Gene(const string& i, const string& n,
-         const string& c, int s, int e, char st)
-        : id(i), name(n), chrom(c), start(s), end(e), strand(st)
     {
-        cout << "Gene created: " << name << endl;
-    }
-
-    ~Gene() {
-        cout << "Gene destroyed: " << name << endl;
+        BufferSink text;
+        emit::bed(text, annotation);
+        emit::gtf(text, annotation[0]);
+        emit::fasta(text, annotation[0].getIsoforms()[0], 10);
+        cout << text.view() << flush;
+
+        // Straight to stdout's descriptor, bypassing iostreams
+        FdSink out(STDOUT_FILENO);
+        out << "FASTA/BED/GTF for " << annotation.size() << " genes: " << text.size() << " bytes\n";
     }
 
-    void addIsoform(const Isoform& iso) {
-        isoforms.push_back(iso);
+    cout << "\n--- Translation ---\n";
+
+    Translator translator;
+    Translator::Batch proteins = translator.translateAll(annotation);
+    for (size_t gi = 0; gi < annotation.size(); ++gi)
+        for (size_t i = proteins.offsets[gi]; i < proteins.offsets[gi + 1]; ++i)
+            cout << annotation[gi].getIsoforms()[i - proteins.offsets[gi]].getName()
+                 << " -> " << proteins.proteins[i].residues() << endl;
+
+    // Forward ORF, then one on the reverse strand
+    DNASequence orfDemo("ATGAAACCCGGGTAGCCTCACCCAAACAT");
+    for (const Translator::ORF& orf : translator.findORFs(orfDemo, 3)) {
+        ProteinSequence p = translator.translate(orfDemo, orf);
+        cout << "ORF frame " << orf.frame << " at " << orf.start << "-" << orf.end
+             << ": " << p.residues() << endl;
     }
 
-    void describe() const {
-        cout << "Gene " << id << " (" << name << ") on "
-             << chrom << ":" << start << "-" << end
-             << " (" << strand << " strand)\n";
+    cout << "\n--- K-mer spectrum ---\n";
 
-        cout << "Isoforms:\n";
-        for (const auto& iso : isoforms)
-            iso.describe();
+    {
+        DNASequence r1("ACGTACGTTTGACGTACGNNACGTACG");
+        RNASequence r2("CGUACGUACGUAAA");
+        KmerCounter32 kmers(4);
+        kmers.count({ &r1, &r2 });
+        cout << kmers.totalKmers() << " 4-mers, " << kmers.distinct() << " distinct (canonical)\n";
+        for (const auto& e : kmers.top(3))
+            cout << e.first << " x" << e.second << endl;
+        vector<uint64_t> hist = kmers.histogram(4);
+        cout << "Histogram 1..4+:";
+        for (size_t c = 1; c < hist.size(); ++c) cout << " " << hist[c];
+        cout << endl;
     }
-};
 
-/* ============================================================
-   MAIN
-   ============================================================ */
-int main() {
+    cout << "\n--- Pairwise alignment ---\n";
 
-    cout << "--- Polymorphic standalone sequences ---\n";
+    {
+        ProteinSequence query("HEAGAWGHEE");
+        ProteinSequence target("PAWHEAE");
+        Aligner local = Aligner::forKind(SequenceKind::Protein);
+        Alignment hit = local.align(query, target, true);
+        cout << "Local: score " << hit.score << ", query " << hit.queryBegin << "-" << hit.queryEnd
+             << ", target " << hit.targetBegin << "-" << hit.targetEnd << ", CIGAR " << hit.cigar << endl;
+
+        DNASequence probe("ACGTTGCA");
+        DNASequence r1("ACGTTGCA"), r2("ACGTGCA"), r3("TTTTTTTT");
+        Aligner global = Aligner::forKind(SequenceKind::DNA, AlignMode::Global);
+        vector<Alignment> scores = global.alignMany(probe, { &r1, &r2, &r3 });
+        cout << "Global scores:";
+        for (const Alignment& a : scores) cout << " " << a.score;
+        cout << endl;
+    }
 
-    // Base pointer → points to derived objects
-    Sequence* s1 = new DNASequence("ACGTACGT");
-    Sequence* s2 = new RNASequence("AUGGCCAUGG");
-    Sequence* s3 = new ProteinSequence("MTAPQLR");
+    cout << "\n--- FM-index motif search ---\n";
 
-    vector<Sequence*> seqs = { s1, s2, s3 };
-
-    for (Sequence* s : seqs) {
-        s->describe();
-        cout << "Length: " << s->length() << endl;
-        cout << "Valid? " << (s->isValid() ? "Yes" : "No") << endl;
+    {
+        DNASequence genome("TTGACATATAATGCGTTGACAGGCTATAATtgacaTTT");
+        genome.buildIndex(4);
+        cout << "TTGACA occurs " << genome.countMotif("TTGACA") << " times at";
+        for (size_t p : genome.findMotif("TTGACA")) cout << " " << p;
         cout << endl;
-    }
 
-    // Deletion (virtual destructor → correct order)
-    for (Sequence* s : seqs)
-        delete s;
+        const string indexPath = "lab5_genome.fmi";
+        genome.attachedIndex()->save(indexPath);
+        {
+            FMIndex mapped(indexPath);
+            vector<size_t> counts = mapped.countMany({ "TATAAT", "GCG", "NNN" });
+            cout << "From " << indexPath << ": TATAAT " << counts[0] << ", GCG " << counts[1]
+                 << ", NNN " << counts[2] << endl;
+        }
+        remove(indexPath.c_str());
+    }
 
-    cout << "\n--- Gene with polymorphic Isoforms ---\n";
+    cout << "\n--- Spliced isoforms over a shared pre-mRNA, GTF round trip ---\n";
 
-    Gene g("ENSG000001", "TP53", "chr17", 7668402, 7687550, '-');
+    {
+        Gene mdm2("ENSG000002", "MDM2", "chr12", 101, 130, '-');
+        mdm2.setPreMRNA(RNASequence("AUGUGCAAUACCAACAUGUCUGUACCUACU"));
+        mdm2.addSplicedIsoform("ENST0011", "MDM2-201", { { 101, 106 }, { 113, 118 }, { 125, 130 } });
+        mdm2.addSplicedIsoform("ENST0012", "MDM2-202", { { 125, 130 }, { 101, 106 } });
+        mdm2.describe();
+
+        // Editing one copy leaves the gene's isoform on the shared bases
+        Isoform edited = mdm2.getIsoforms()[1];
+        edited.mutableSequence().reverseComplementInPlace();
+        string original = mdm2.getIsoforms()[1].sequence().str();
+        cout << "Edited copy: " << edited.sequence().str() << " (spliced: " << edited.isSpliced()
+             << "), original: " << original << endl;
+
+        // Round trip: GTF written by emit::gtf, bases from a FASTA reference
+        const string fastaPath = "lab5_chr12.fa", gtfPath = "lab5_mdm2.gtf";
+        {
+            DNASequence span = mdm2.preMRNA()->reverseTranscribe();
+            span.reverseComplementInPlace();
+            ofstream(fastaPath) << ">chr12\n" << string(100, 'N') << span.str() << "ACGT\n";
+            BufferSink gtf;
+            emit::gtf(gtf, mdm2);
+            ofstream(gtfPath) << gtf.view();
+        }
+        try {
+            ReferenceStore reference(fastaPath);
+            GeneAnnotation loaded = AnnotationReader(gtfPath).load(&reference);
+            for (const Isoform& iso : loaded[0].getIsoforms()) {
+                string bases = iso.sequence().str();
+                cout << "Loaded " << iso.getId() << " from " << gtfPath << ": " << bases << endl;
+            }
+        } catch (const exception& e) {
+            cout << "Error: " << e.what() << endl;
+        }
+        remove(gtfPath.c_str());
+        remove(fastaPath.c_str());
+        remove((fastaPath + ".fai").c_str());
+    }
 
-    Isoform iso1("ENST0001", "TP53-201", "AUGGCCAUGGCGCCC");
-    Isoform iso2("ENST0002", "TP53-202", "AUGCCUGAUGCUGUAG");
+    cout << "\n--- Edits with cached properties ---\n";
 
-    g.addIsoform(iso1);
-    g.addIsoform(iso2);
+    {
+        DNASequence allele("ACGTTGCATGCGCGATCGATTACA");
+        Composition c = allele.composition();
+        cout << "Before: GC " << c.gc() << ", CpG " << c.cpg << ", hash " << hex << allele.contentHash() << dec << endl;
+
+        allele.setBase(4, 'C');             // SNV
+        allele.insert(10, "GGn");           // insertion with an ambiguous base
+        allele.erase(20, 3);                // deletion
+        c = allele.composition();
+        cout << "After " << allele.revision() << " edits: " << allele.str() << ", GC " << c.gc()
+             << ", CpG " << c.cpg << ", valid " << allele.isValid() << ", hash " << hex
+             << allele.contentHash() << dec << endl;
+        cout << "Dirty:";
+        for (const auto& d : allele.dirtyRanges()) cout << " [" << d.start << ", " << d.start + d.len << ")";
+        cout << endl;
+    }
 
-    g.describe();
+#if LAB5_TRACE == 1
+    cout << "\n--- Lifecycle trace ---\n";
+    RingTrace::dump(cout);
+#endif
 
     cout << "\n--- End of main ---\n";
 
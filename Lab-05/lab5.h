@@ -0,0 +1,6599 @@
+/* ============================================================
+   Lab 5 model: sequences, genes, isoforms and the genome-scale
+   machinery around them. Header-only so the demo (lab5.cpp) and
+   the benchmarks (bench/) share one definition; see the
+   top-level CMakeLists.txt.
+   ============================================================ */
+#ifndef LAB5_H
+#define LAB5_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cctype>
+#include <string_view>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <exception>
+#include <charconv>
+#include <fstream>
+#include <unordered_map>
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include <memory_resource>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <variant>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef LAB5_WITH_ZLIB
+#include <zlib.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+/* ============================================================
+   ByteClass: a set of accepted bytes, kept both as a 256-entry
+   table (scalar path) and as a pair of 16-entry nibble tables
+   for pshufb-based class checks: byte b is accepted iff
+   lo[b & 15] & hi[b >> 4] != 0.
+   ============================================================ */
+struct ByteClass {
+    array<bool, 256> accept{};
+    alignas(16) uint8_t lo[16] = {};
+    alignas(16) uint8_t hi[16] = {};
+    bool shuffleable = false;   // false → more than 8 distinct rows
+
+    template <typename Pred>
+    explicit ByteClass(Pred pred) {
+        for (int b = 0; b < 256; ++b)
+            accept[b] = pred(static_cast<unsigned char>(b));
+
+        // One bit per distinct "row" of accepted low nibbles
+        uint16_t rows[8];
+        int nrows = 0;
+        for (int h = 0; h < 16; ++h) {
+            uint16_t row = 0;
+            for (int l = 0; l < 16; ++l)
+                if (accept[h * 16 + l]) row |= uint16_t(1u << l);
+            if (!row) continue;
+
+            int bit = 0;
+            while (bit < nrows && rows[bit] != row) ++bit;
+            if (bit == nrows) {
+                if (nrows == 8) return;     // scalar only
+                rows[nrows++] = row;
+            }
+            hi[h] |= uint8_t(1u << bit);
+            for (int l = 0; l < 16; ++l)
+                if (row & (1u << l)) lo[l] |= uint8_t(1u << bit);
+        }
+        shuffleable = true;
+    }
+
+    bool operator()(char c) const { return accept[static_cast<unsigned char>(c)]; }
+};
+
+/* ============================================================
+   Validation kernels: return the offset of the first byte not
+   in the class, or n if every byte is accepted. The widest
+   kernel the CPU supports is picked once at startup.
+   ============================================================ */
+namespace validation {
+
+const size_t npos = static_cast<size_t>(-1);
+
+inline size_t scalar(const char* p, size_t n, const ByteClass& cls) {
+    size_t i = 0;
+    // Unrolled by 8 with a single branch per block
+    for (; i + 8 <= n; i += 8) {
+        bool ok = cls(p[i]) & cls(p[i+1]) & cls(p[i+2]) & cls(p[i+3])
+                & cls(p[i+4]) & cls(p[i+5]) & cls(p[i+6]) & cls(p[i+7]);
+        if (!ok) break;
+    }
+    for (; i < n; ++i)
+        if (!cls(p[i])) return i;
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.2")))
+inline size_t sse42(const char* p, size_t n, const ByteClass& cls) {
+    const __m128i loTbl = _mm_load_si128(reinterpret_cast<const __m128i*>(cls.lo));
+    const __m128i hiTbl = _mm_load_si128(reinterpret_cast<const __m128i*>(cls.hi));
+    const __m128i nib = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i l = _mm_shuffle_epi8(loTbl, _mm_and_si128(v, nib));
+        __m128i h = _mm_shuffle_epi8(hiTbl, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+        int bad = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero));
+        if (bad) return i + __builtin_ctz(bad);
+    }
+    return i + scalar(p + i, n - i, cls);
+}
+
+__attribute__((target("avx2")))
+inline size_t avx2(const char* p, size_t n, const ByteClass& cls) {
+    const __m256i loTbl = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(cls.lo)));
+    const __m256i hiTbl = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(cls.hi)));
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i l = _mm256_shuffle_epi8(loTbl, _mm256_and_si256(v, nib));
+        __m256i h = _mm256_shuffle_epi8(hiTbl, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+        unsigned bad = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero));
+        if (bad) return i + __builtin_ctz(bad);
+    }
+    return i + sse42(p + i, n - i, cls);
+}
+
+#endif
+
+enum class Kernel { Scalar, SSE42, AVX2 };
+
+inline Kernel detectKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) return Kernel::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return Kernel::SSE42;
+#endif
+    return Kernel::Scalar;
+}
+
+inline Kernel activeKernel() {
+    static const Kernel k = detectKernel();
+    return k;
+}
+
+inline const char* kernelName(Kernel k) {
+    switch (k) {
+        case Kernel::AVX2:  return "AVX2";
+        case Kernel::SSE42: return "SSE4.2";
+        default:            return "scalar";
+    }
+}
+
+// Offset of the first rejected byte in [p, p+n), or n
+inline size_t findInvalid(const char* p, size_t n, const ByteClass& cls) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (cls.shuffleable) {
+        switch (activeKernel()) {
+            case Kernel::AVX2:  return avx2(p, n, cls);
+            case Kernel::SSE42: return sse42(p, n, cls);
+            default: break;
+        }
+    }
+#endif
+    return scalar(p, n, cls);
+}
+
+// Same, but npos when everything is accepted
+inline size_t firstInvalid(string_view s, const ByteClass& cls) {
+    size_t i = findInvalid(s.data(), s.size(), cls);
+    return i == s.size() ? npos : i;
+}
+
+// The alphabets used by the Sequence hierarchy
+inline const ByteClass& dnaClass() {
+    static const ByteClass c([](unsigned char b) {
+        return b == 'A' || b == 'C' || b == 'G' || b == 'T';
+    });
+    return c;
+}
+
+inline const ByteClass& rnaClass() {
+    static const ByteClass c([](unsigned char b) {
+        return b == 'A' || b == 'C' || b == 'G' || b == 'U';
+    });
+    return c;
+}
+
+inline const ByteClass& proteinClass() {
+    static const ByteClass c([](unsigned char b) {
+        return (b >= 'A' && b <= 'Z') || (b >= 'a' && b <= 'z');
+    });
+    return c;
+}
+
+}  // namespace validation
+
+/* ============================================================
+   Strand kernels on nucleotide text: reverse complement (IUPAC
+   aware, case preserving), T<->U transcription and uppercasing.
+   The AVX2 paths handle 32 bytes per step; reverse complement
+   falls back to the table for blocks with IUPAC codes.
+   ============================================================ */
+namespace strand {
+
+// 256-entry complement; fourth is what A pairs with ('T' or 'U')
+inline const array<char, 256>& complementTable(char fourth = 'T') {
+    auto make = [](char f) {
+        array<char, 256> t;
+        for (int i = 0; i < 256; ++i) t[i] = char(i);
+        const char* pairs[] = { "AT", "CG", "GC", "TA", "UA", "RY", "YR", "KM", "MK",
+                                "SS", "WW", "BV", "VB", "DH", "HD", "NN" };
+        for (const char* p : pairs) {
+            char to = (p[0] != 'A') ? p[1] : f;
+            t[static_cast<unsigned char>(p[0])] = to;
+            t[static_cast<unsigned char>(p[0] - 'A' + 'a')] = char(to - 'A' + 'a');
+        }
+        return t;
+    };
+    static const array<char, 256> dna = make('T');
+    static const array<char, 256> rna = make('U');
+    return fourth == 'U' ? rna : dna;
+}
+
+// Bytes the vector path can complement: ACGTUN in either case
+inline const ByteClass& fastClass() {
+    static const ByteClass c([](unsigned char b) {
+        return strchr("ACGTUNacgtun", b) != nullptr && b != 0;
+    });
+    return c;
+}
+
+inline void reverseComplementScalar(const char* in, size_t n, char* out, char fourth) {
+    const array<char, 256>& comp = complementTable(fourth);
+    for (size_t i = 0; i < n; ++i)
+        out[n - 1 - i] = comp[static_cast<unsigned char>(in[i])];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Complement by low nibble (A=1 C=3 T=4 U=5 G=7 N=14), keeping case
+__attribute__((target("avx2")))
+inline __m256i complement32(__m256i v, char fourth) {
+    const __m256i lut = _mm256_setr_epi8(
+        0, fourth, 0, 'G', 'A', 'A', 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0,
+        0, fourth, 0, 'G', 'A', 'A', 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0);
+    __m256i c = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, _mm256_set1_epi8(0x0F)));
+    return _mm256_or_si256(c, _mm256_and_si256(v, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i reverse32(__m256i v) {
+    const __m256i rev = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, rev), 0x4E);
+}
+
+// Reverse complement of one 32-byte block
+__attribute__((target("avx2")))
+inline __m256i revcomp32(const char* p, char fourth) {
+    if (validation::avx2(p, 32, fastClass()) == 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        return complement32(reverse32(v), fourth);
+    }
+    alignas(32) char tmp[32];
+    reverseComplementScalar(p, 32, tmp, fourth);
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(tmp));
+}
+
+__attribute__((target("avx2")))
+inline void reverseComplementAVX2(const char* in, size_t n, char* out, char fourth) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n - i - 32), revcomp32(in + i, fourth));
+    reverseComplementScalar(in + i, n - i, out, fourth);
+}
+
+__attribute__((target("avx2")))
+inline void reverseComplementInPlaceAVX2(char* p, size_t n, char fourth) {
+    size_t i = 0, j = n;
+    // Swap 32-byte blocks from both ends
+    for (; i + 64 <= j; i += 32, j -= 32) {
+        __m256i front = revcomp32(p + i, fourth);
+        __m256i back = revcomp32(p + j - 32, fourth);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), back);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + j - 32), front);
+    }
+    const array<char, 256>& comp = complementTable(fourth);
+    for (; i + 1 < j; ++i, --j) {
+        char a = comp[static_cast<unsigned char>(p[i])];
+        p[i] = comp[static_cast<unsigned char>(p[j - 1])];
+        p[j - 1] = a;
+    }
+    if (i + 1 == j) p[i] = comp[static_cast<unsigned char>(p[i])];
+}
+
+// Adds delta to every byte equal to a or b
+__attribute__((target("avx2")))
+inline void shiftMatchesAVX2(char* p, size_t n, char a, char b, int8_t delta) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    const __m256i vd = _mm256_set1_epi8(delta);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i),
+                            _mm256_add_epi8(v, _mm256_and_si256(hit, vd)));
+    }
+    for (; i < n; ++i)
+        if (p[i] == a || p[i] == b) p[i] = char(p[i] + delta);
+}
+
+__attribute__((target("avx2")))
+inline void toUpperAVX2(char* p, size_t n) {
+    // 'a'..'z' are the bytes where (b - 'a') < 26 as unsigned
+    const __m256i base = _mm256_set1_epi8('a'), span = _mm256_set1_epi8(25);
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i off = _mm256_sub_epi8(v, base);
+        __m256i lower = _mm256_cmpeq_epi8(_mm256_min_epu8(off, span), off);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i),
+                            _mm256_andnot_si256(_mm256_and_si256(lower, bit), v));
+    }
+    for (; i < n; ++i)
+        if (p[i] >= 'a' && p[i] <= 'z') p[i] = char(p[i] - 32);
+}
+
+#endif
+
+inline bool useAVX2() {
+#if defined(__x86_64__) || defined(__i386__)
+    return validation::activeKernel() == validation::Kernel::AVX2;
+#else
+    return false;
+#endif
+}
+
+// out[0, n) = reverse complement of in[0, n); buffers must not overlap
+inline void reverseComplement(const char* in, size_t n, char* out, char fourth = 'T') {
+#if defined(__x86_64__) || defined(__i386__)
+    if (useAVX2()) return reverseComplementAVX2(in, n, out, fourth);
+#endif
+    reverseComplementScalar(in, n, out, fourth);
+}
+
+inline void reverseComplementInPlace(char* p, size_t n, char fourth = 'T') {
+#if defined(__x86_64__) || defined(__i386__)
+    if (useAVX2()) return reverseComplementInPlaceAVX2(p, n, fourth);
+#endif
+    const array<char, 256>& comp = complementTable(fourth);
+    reverse(p, p + n);
+    for (size_t i = 0; i < n; ++i) p[i] = comp[static_cast<unsigned char>(p[i])];
+}
+
+inline string reverseComplement(string_view s, char fourth = 'T') {
+    string out(s.size(), '\0');
+    reverseComplement(s.data(), s.size(), &out[0], fourth);
+    return out;
+}
+
+inline void shiftMatches(char* p, size_t n, char a, char b, int8_t delta) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (useAVX2()) return shiftMatchesAVX2(p, n, a, b, delta);
+#endif
+    for (size_t i = 0; i < n; ++i)
+        if (p[i] == a || p[i] == b) p[i] = char(p[i] + delta);
+}
+
+// DNA -> RNA (T->U, t->u) and back, in place
+inline void transcribe(char* p, size_t n) { shiftMatches(p, n, 'T', 't', 1); }
+inline void reverseTranscribe(char* p, size_t n) { shiftMatches(p, n, 'U', 'u', -1); }
+
+inline void toUpper(char* p, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (useAVX2()) return toUpperAVX2(p, n);
+#endif
+    for (size_t i = 0; i < n; ++i)
+        if (p[i] >= 'a' && p[i] <= 'z') p[i] = char(p[i] - 32);
+}
+
+}  // namespace strand
+
+/* ============================================================
+   Composition: base counts of a stretch of nucleotides
+   T and U share a slot; "other" is N and IUPAC codes; CpG counts
+   C followed by G (either case).
+   ============================================================ */
+struct Composition {
+    array<uint64_t, 4> bases{};     // A, C, G, T/U
+    uint64_t other = 0;
+    uint64_t cpg = 0;
+
+    uint64_t acgt() const { return bases[0] + bases[1] + bases[2] + bases[3]; }
+    uint64_t length() const { return acgt() + other; }
+
+    // (C+G) / (A+C+G+T); NaN when there are no unambiguous bases
+    double gc() const {
+        uint64_t n = acgt();
+        return n ? double(bases[1] + bases[2]) / double(n) : nan("");
+    }
+
+    // CpG * N / (C * G), Gardiner-Garden & Frommer; NaN without C or G
+    double cpgObservedExpected() const {
+        double expected = double(bases[1]) * double(bases[2]);
+        return expected > 0 ? double(cpg) * double(acgt()) / expected : nan("");
+    }
+
+    // Pairs spanning the join are not seen; callers add them
+    Composition& operator+=(const Composition& o) {
+        for (size_t i = 0; i < 4; ++i) bases[i] += o.bases[i];
+        other += o.other;
+        cpg += o.cpg;
+        return *this;
+    }
+
+    // Takes a stretch back out, e.g. the old window of an edit
+    Composition& operator-=(const Composition& o) {
+        for (size_t i = 0; i < 4; ++i) bases[i] -= o.bases[i];
+        other -= o.other;
+        cpg -= o.cpg;
+        return *this;
+    }
+};
+
+// Residue counts of a protein, 'A'-'Z' in either case
+struct AminoAcidComposition {
+    array<uint64_t, 26> residues{};
+    uint64_t other = 0;
+
+    uint64_t length() const {
+        uint64_t n = other;
+        for (uint64_t c : residues) n += c;
+        return n;
+    }
+
+    double frequency(char aa) const {
+        uint64_t n = length();
+        unsigned i = unsigned((aa | 0x20) - 'a');
+        return n && i < 26 ? double(residues[i]) / double(n) : 0.0;
+    }
+};
+
+/* ============================================================
+   Composition kernels on text (e.g. mmapped reference windows).
+   AVX2 compares 32 bytes against each base and popcounts the
+   movemasks; CpG is the C mask ANDed with the G mask shifted by
+   one. The scalar path uses a byte class table.
+   ============================================================ */
+namespace stats {
+
+/* 0-3 = A C G T/U (any case), 4 = other. fourth picks the alphabet:
+   'T' (DNA) or 'U' (RNA) counts only that letter in slot 3, as
+   PackedBases does; 0 accepts both, for text of unknown kind. */
+inline array<uint8_t, 256> makeBaseIndex(char fourth) {
+    array<uint8_t, 256> a;
+    a.fill(4);
+    const char* letters = "ACGTU";
+    for (int i = 0; i < 5; ++i) {
+        if (fourth && i >= 3 && letters[i] != fourth) continue;
+        a[static_cast<unsigned char>(letters[i])] = uint8_t(min(i, 3));
+        a[static_cast<unsigned char>(letters[i] | 0x20)] = uint8_t(min(i, 3));
+    }
+    return a;
+}
+
+inline const array<uint8_t, 256>& baseIndex(char fourth = 0) {
+    static const array<uint8_t, 256> either = makeBaseIndex(0);
+    static const array<uint8_t, 256> dna = makeBaseIndex('T');
+    static const array<uint8_t, 256> rna = makeBaseIndex('U');
+    return fourth == 'T' ? dna : fourth == 'U' ? rna : either;
+}
+
+// prevC says whether the byte before p was a C (for a CpG across calls)
+inline void countTextScalar(const char* p, size_t n, Composition& c, bool& prevC, char fourth = 0) {
+    const array<uint8_t, 256>& idx = baseIndex(fourth);
+    uint64_t counts[5] = {};
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t b = idx[static_cast<unsigned char>(p[i])];
+        ++counts[b];
+        c.cpg += (prevC && b == 2);
+        prevC = (b == 1);
+    }
+    for (size_t i = 0; i < 4; ++i) c.bases[i] += counts[i];
+    c.other += counts[4];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,popcnt")))
+inline void countTextAVX2(const char* p, size_t n, Composition& c, bool& prevC, char fourth = 0) {
+    const __m256i upper = _mm256_set1_epi8(char(0xDF));
+    const __m256i vA = _mm256_set1_epi8('A'), vC = _mm256_set1_epi8('C');
+    const __m256i vG = _mm256_set1_epi8('G'), vT = _mm256_set1_epi8('T');
+    const __m256i vU = _mm256_set1_epi8('U');
+    uint64_t a = 0, cc = 0, g = 0, t = 0, cpg = 0;
+    uint32_t carry = prevC;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), upper);
+        uint32_t ma = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vA)));
+        uint32_t mc = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vC)));
+        uint32_t mg = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vG)));
+        uint32_t mt = uint32_t(_mm256_movemask_epi8(
+            fourth == 'T' ? _mm256_cmpeq_epi8(v, vT)
+            : fourth == 'U' ? _mm256_cmpeq_epi8(v, vU)
+            : _mm256_or_si256(_mm256_cmpeq_epi8(v, vT), _mm256_cmpeq_epi8(v, vU))));
+        a += __builtin_popcount(ma);
+        cc += __builtin_popcount(mc);
+        g += __builtin_popcount(mg);
+        t += __builtin_popcount(mt);
+        cpg += __builtin_popcount(((mc << 1) | carry) & mg);
+        carry = mc >> 31;
+    }
+    c.bases[0] += a; c.bases[1] += cc; c.bases[2] += g; c.bases[3] += t;
+    c.other += i - (a + cc + g + t);
+    c.cpg += cpg;
+    prevC = carry;
+    countTextScalar(p + i, n - i, c, prevC, fourth);
+}
+
+#endif
+
+inline void countText(const char* p, size_t n, Composition& c, bool& prevC, char fourth = 0) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (validation::activeKernel() == validation::Kernel::AVX2)
+        return countTextAVX2(p, n, c, prevC, fourth);
+#endif
+    countTextScalar(p, n, c, prevC, fourth);
+}
+
+inline Composition countText(string_view s) {
+    Composition c;
+    bool prevC = false;
+    countText(s.data(), s.size(), c, prevC);
+    return c;
+}
+
+// Byte histogram into four tables, so repeated bytes do not stall on one counter
+inline AminoAcidComposition countResidues(string_view s) {
+    uint32_t h[4][256] = {};
+    AminoAcidComposition out;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+    size_t n = s.size();
+    while (n) {
+        // Flush before the 32-bit counters could wrap
+        size_t take = min<size_t>(n, size_t(1) << 30);
+        size_t i = 0;
+        for (; i + 4 <= take; i += 4) {
+            ++h[0][p[i]]; ++h[1][p[i + 1]]; ++h[2][p[i + 2]]; ++h[3][p[i + 3]];
+        }
+        for (; i < take; ++i) ++h[0][p[i]];
+        for (unsigned b = 0; b < 256; ++b) {
+            uint64_t total = uint64_t(h[0][b]) + h[1][b] + h[2][b] + h[3][b];
+            unsigned r = (b | 0x20) - 'a';
+            if (isalpha(int(b)) && r < 26) out.residues[r] += total;
+            else out.other += total;
+            h[0][b] = h[1][b] = h[2][b] = h[3][b] = 0;
+        }
+        p += take;
+        n -= take;
+    }
+    return out;
+}
+
+}  // namespace stats
+
+/* ============================================================
+   OutputSink: buffered text output without per-field
+   allocations. Writes go into a raw char window; only when it
+   is full does the (virtual) overflow() drain it (fd, stream)
+   or grow it (buffer, string). Integers are formatted with
+   to_chars straight into the window.
+   ============================================================ */
+class OutputSink {
+protected:
+    char* cur = nullptr;
+    char* lim = nullptr;
+
+    // Makes room for at least min(need, capacity) more bytes
+    virtual void overflow(size_t need) = 0;
+
+public:
+    OutputSink() = default;
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+    virtual ~OutputSink() = default;
+
+    // Pushes buffered bytes to the destination (no-op for in-memory sinks)
+    virtual void flush() {}
+
+    OutputSink& put(char c) {
+        if (cur == lim) overflow(1);
+        *cur++ = c;
+        return *this;
+    }
+
+    OutputSink& write(const char* p, size_t n) {
+        while (n) {
+            if (cur == lim) overflow(n);
+            size_t k = min(n, size_t(lim - cur));
+            memcpy(cur, p, k);
+            cur += k;
+            p += k;
+            n -= k;
+        }
+        return *this;
+    }
+
+    OutputSink& write(string_view s) { return write(s.data(), s.size()); }
+
+    template <typename Int, typename = enable_if_t<is_integral<Int>::value>>
+    OutputSink& integer(Int v) {
+        if (size_t(lim - cur) < 24) overflow(24);
+        cur = to_chars(cur, lim, v).ptr;
+        return *this;
+    }
+
+    // n copies of c (padding, separators)
+    OutputSink& fill(char c, size_t n) {
+        while (n) {
+            if (cur == lim) overflow(n);
+            size_t k = min(n, size_t(lim - cur));
+            memset(cur, c, k);
+            cur += k;
+            n -= k;
+        }
+        return *this;
+    }
+
+    OutputSink& operator<<(char c) { return put(c); }
+    OutputSink& operator<<(string_view s) { return write(s); }
+    OutputSink& operator<<(const char* s) { return write(string_view(s)); }
+    OutputSink& operator<<(const string& s) { return write(s.data(), s.size()); }
+    OutputSink& operator<<(int v) { return integer(v); }
+    OutputSink& operator<<(unsigned v) { return integer(v); }
+    OutputSink& operator<<(long v) { return integer(v); }
+    OutputSink& operator<<(unsigned long v) { return integer(v); }
+    OutputSink& operator<<(long long v) { return integer(v); }
+    OutputSink& operator<<(unsigned long long v) { return integer(v); }
+};
+
+// Growable in-memory buffer; view() is the text so far
+class BufferSink final : public OutputSink {
+private:
+    vector<char> buf;
+
+    void overflow(size_t need) override {
+        size_t used = size();
+        buf.resize(max(buf.size() * 2, used + max<size_t>(need, 256)));
+        cur = buf.data() + used;
+        lim = buf.data() + buf.size();
+    }
+
+public:
+    explicit BufferSink(size_t capacity = 1 << 12) : buf(max<size_t>(capacity, 64)) {
+        cur = buf.data();
+        lim = cur + buf.size();
+    }
+
+    size_t size() const { return size_t(cur - buf.data()); }
+    string_view view() const { return string_view(buf.data(), size()); }
+    void clear() { cur = buf.data(); }
+};
+
+// Appends to a caller's string; the string is final after flush() or destruction
+class StringSink final : public OutputSink {
+private:
+    string& out;
+
+    void overflow(size_t need) override {
+        size_t used = size_t(cur - &out[0]);
+        out.resize(max(out.size() * 2, used + max<size_t>(need, 256)));
+        cur = &out[0] + used;
+        lim = &out[0] + out.size();
+    }
+
+public:
+    explicit StringSink(string& s) : out(s) {
+        size_t used = out.size();
+        out.resize(used + 256);
+        cur = &out[0] + used;
+        lim = &out[0] + out.size();
+    }
+
+    ~StringSink() override { flush(); }
+
+    void flush() override {
+        size_t used = size_t(cur - &out[0]);
+        out.resize(used);
+        cur = lim = &out[0] + used;   // the next write grows it again
+    }
+};
+
+// Fixed buffer drained into a file descriptor with write(2)
+class FdSink final : public OutputSink {
+private:
+    int fd;
+    vector<char> buf;
+
+    void drain() {
+        const char* p = buf.data();
+        size_t n = size_t(cur - p);
+        while (n) {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("FdSink: write failed: ") + strerror(errno));
+            }
+            p += w;
+            n -= size_t(w);
+        }
+        cur = buf.data();
+    }
+
+    void overflow(size_t) override { drain(); }
+
+public:
+    explicit FdSink(int f, size_t capacity = 1 << 16) : fd(f), buf(max<size_t>(capacity, 64)) {
+        cur = buf.data();
+        lim = cur + buf.size();
+    }
+
+    ~FdSink() override {
+        try {
+            drain();
+        } catch (...) {
+        }
+    }
+
+    void flush() override { drain(); }
+};
+
+// Fixed buffer drained into an ostream (e.g. cout) in blocks
+class StreamSink final : public OutputSink {
+private:
+    ostream& os;
+    array<char, 1 << 12> buf;
+
+    void overflow(size_t) override { flush(); }
+
+public:
+    explicit StreamSink(ostream& o) : os(o) {
+        cur = buf.data();
+        lim = cur + buf.size();
+    }
+
+    ~StreamSink() override { flush(); }
+
+    void flush() override {
+        os.write(buf.data(), cur - buf.data());
+        cur = buf.data();
+    }
+};
+
+// Allocator used by every class whose buffers can live in an arena
+using SeqAllocator = pmr::polymorphic_allocator<char>;
+
+/* ============================================================
+   PackedBases: 2-bit nucleotide store
+   A, C, G and T (or U) are packed 32 to a 64-bit word.
+   Everything else (N, IUPAC codes, gaps) is kept as runs in a
+   side table, and lowercase (soft-masked) stretches as mask
+   runs, so the original text is reproduced exactly.
+   ============================================================ */
+class PackedBases {
+public:
+    struct Run  { size_t start; size_t len; char base; };  // ambiguity run
+    struct Span { size_t start; size_t len; };             // lowercase run
+
+    static constexpr uint8_t INVALID = 0xFF;
+
+    using allocator_type = SeqAllocator;
+
+private:
+    pmr::vector<uint64_t> words;
+    size_t n = 0;
+    char fourth = 'T';      // letter for code 3: 'T' (DNA) or 'U' (RNA)
+    pmr::vector<Run> ambig;     // sorted, non-overlapping
+    pmr::vector<Span> masked;   // sorted, non-overlapping
+
+    // Finds the run containing i, or nullptr
+    template <typename R>
+    static const R* findRun(const pmr::vector<R>& runs, size_t i) {
+        auto it = upper_bound(runs.begin(), runs.end(), i,
+                              [](size_t pos, const R& r) { return pos < r.start; });
+        if (it == runs.begin()) return nullptr;
+        --it;
+        return (i < it->start + it->len) ? &*it : nullptr;
+    }
+
+    void setCode(size_t i, uint8_t code) {
+        words[i >> 5] |= uint64_t(code) << ((i & 31) * 2);
+    }
+
+    // Resets [start, start+len) to code 0, a word at a time
+    void clearCodes(size_t start, size_t len) {
+        for (size_t i = start, end = start + len; i < end; ) {
+            size_t w = i >> 5, off = (i & 31) * 2;
+            size_t take = min(end - i, 32 - (i & 31));
+            uint64_t mask = (take == 32) ? ~0ULL : (((1ULL << (take * 2)) - 1) << off);
+            words[w] &= ~mask;
+            i += take;
+        }
+    }
+
+    // 32 codes starting at base i; codes past the end read as 0
+    static uint64_t codesAt(const pmr::vector<uint64_t>& w, size_t i) {
+        size_t k = i >> 5, sh = (i & 31) * 2;
+        uint64_t x = k < w.size() ? w[k] >> sh : 0;
+        if (sh && k + 1 < w.size()) x |= w[k + 1] << (64 - sh);
+        return x;
+    }
+
+    // Copies count codes from src (at base from) over dst (at base to)
+    static void copyCodes(const pmr::vector<uint64_t>& src, size_t from,
+                          pmr::vector<uint64_t>& dst, size_t to, size_t count) {
+        for (size_t k = 0; k < count; k += 32) {
+            size_t take = min<size_t>(32, count - k);
+            uint64_t keep = (take == 32) ? ~0ULL : (1ULL << (take * 2)) - 1;
+            uint64_t bits = codesAt(src, from + k) & keep;
+            size_t w = (to + k) >> 5, sh = ((to + k) & 31) * 2;
+            dst[w] = (dst[w] & ~(keep << sh)) | (bits << sh);
+            if (sh && sh + take * 2 > 64)
+                dst[w + 1] = (dst[w + 1] & ~(keep >> (64 - sh))) | (bits >> (64 - sh));
+        }
+    }
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+    static uint64_t term(const Run& r) { return mix(mix(r.start) + r.len * 0x9E3779B97F4A7C15ULL + uint8_t(r.base)); }
+    static uint64_t term(const Span& r) { return mix(mix(~r.start) + r.len); }
+
+    /* Replaces the runs touching [pos, pos+len) by their parts outside
+       it plus fresh (relative to pos, newLen long), shifts later runs
+       and merges neighbours. Returns the change in their hash terms. */
+    template <typename R, typename Same>
+    static uint64_t spliceRuns(pmr::vector<R>& runs, size_t pos, size_t len,
+                               const pmr::vector<R>& fresh, size_t newLen, Same same) {
+        auto i0 = partition_point(runs.begin(), runs.end(),
+                                  [pos](const R& r) { return r.start + r.len < pos; });
+        auto i1 = partition_point(i0, runs.end(),
+                                  [&](const R& r) { return r.start <= pos + len; });
+        uint64_t removed = 0, added = 0;
+        vector<R> mid;
+        auto push = [&](R piece) {
+            if (piece.len == 0) return;
+            if (!mid.empty() && mid.back().start + mid.back().len == piece.start && same(mid.back(), piece))
+                mid.back().len += piece.len;
+            else
+                mid.push_back(piece);
+        };
+
+        for (auto it = i0; it != i1; ++it) {
+            removed += term(*it);
+            if (it->start < pos) {
+                R piece = *it;
+                piece.len = min(it->start + it->len, pos) - it->start;
+                push(piece);
+            }
+        }
+        for (R piece : fresh) {
+            piece.start += pos;
+            push(piece);
+        }
+        for (auto it = i0; it != i1; ++it) {
+            size_t from = max(it->start, pos + len), end = it->start + it->len;
+            if (end > from) {
+                R piece = *it;
+                piece.start = from - len + newLen;
+                piece.len = end - from;
+                push(piece);
+            }
+        }
+        for (const R& r : mid) added += term(r);
+
+        if (newLen != len)
+            for (auto it = i1; it != runs.end(); ++it) {
+                removed += term(*it);
+                it->start = it->start - len + newLen;
+                added += term(*it);
+            }
+
+        size_t at = size_t(i0 - runs.begin());
+        if (mid.size() == size_t(i1 - i0)) {
+            copy(mid.begin(), mid.end(), i0);
+        } else {
+            runs.erase(i0, i1);
+            runs.insert(runs.begin() + ptrdiff_t(at), mid.begin(), mid.end());
+        }
+        return added - removed;
+    }
+
+    // Reverses the order of the 2-bit codes in a word
+    static uint64_t reverseCodes(uint64_t x) {
+        x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+        x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+        return __builtin_bswap64(x);
+    }
+
+public:
+    // Maps a character to its 2-bit code (bit 2 set = lowercase),
+    // or INVALID if it has to go to the ambiguity table.
+    static const array<uint8_t, 256>& codeTable(char fourth) {
+        static const array<uint8_t, 256> dna = makeTable('T');
+        static const array<uint8_t, 256> rna = makeTable('U');
+        return fourth == 'U' ? rna : dna;
+    }
+
+    static array<uint8_t, 256> makeTable(char fourth) {
+        array<uint8_t, 256> t;
+        t.fill(INVALID);
+        const char letters[4] = { 'A', 'C', 'G', fourth };
+        for (uint8_t code = 0; code < 4; ++code) {
+            t[static_cast<unsigned char>(letters[code])] = code;
+            t[static_cast<unsigned char>(letters[code] - 'A' + 'a')] = code | 4;
+        }
+        return t;
+    }
+
+    PackedBases() = default;
+    explicit PackedBases(const allocator_type& a)
+        : words(a), ambig(a), masked(a) {}
+
+    PackedBases(const PackedBases&) = default;
+    PackedBases& operator=(const PackedBases&) = default;
+
+    PackedBases(const PackedBases& o, const allocator_type& a)
+        : words(o.words, a), n(o.n), fourth(o.fourth),
+          ambig(o.ambig, a), masked(o.masked, a) {}
+
+    PackedBases(PackedBases&& o, const allocator_type& a)
+        : words(move(o.words), a), n(exchange(o.n, 0)), fourth(o.fourth),
+          ambig(move(o.ambig), a), masked(move(o.masked), a) {}
+
+    // Moved-from stores are left empty rather than with a stale size
+    PackedBases(PackedBases&& o) noexcept
+        : words(move(o.words)), n(exchange(o.n, 0)), fourth(o.fourth),
+          ambig(move(o.ambig)), masked(move(o.masked)) {}
+
+    PackedBases& operator=(PackedBases&& o) noexcept {
+        words = move(o.words);
+        n = exchange(o.n, 0);
+        fourth = o.fourth;
+        ambig = move(o.ambig);
+        masked = move(o.masked);
+        return *this;
+    }
+
+    // Rebuilds stored parts, e.g. from a snapshot blob; runs must be sorted
+    PackedBases(const uint64_t* w, size_t count, char t,
+                const vector<Run>& runs, const vector<Span>& spans,
+                const allocator_type& a = {})
+        : words(w, w + (count + 31) / 32, a), n(count), fourth(t),
+          ambig(runs.begin(), runs.end(), a), masked(spans.begin(), spans.end(), a) {}
+
+    PackedBases(string_view text, char t = 'T', const allocator_type& a = {})
+        : words((text.size() + 31) / 32, 0, a), n(text.size()), fourth(t),
+          ambig(a), masked(a)
+    {
+        const array<uint8_t, 256>& table = codeTable(fourth);
+        const ByteClass& clean = (fourth == 'U') ? validation::rnaClass()
+                                                 : validation::dnaClass();
+
+        for (size_t i = 0; i < n; ++i) {
+            // Uppercase stretches need no side-table bookkeeping
+            size_t run = validation::findInvalid(text.data() + i, n - i, clean);
+            for (size_t end = i + run; i < end; ++i)
+                setCode(i, table[static_cast<unsigned char>(text[i])]);
+            if (i == n) break;
+
+            char c = text[i];
+            uint8_t code = table[static_cast<unsigned char>(c)];
+
+            if (code == INVALID) {
+                if (!ambig.empty() && ambig.back().base == c
+                    && ambig.back().start + ambig.back().len == i)
+                    ++ambig.back().len;
+                else
+                    ambig.push_back({ i, 1, c });
+                continue;
+            }
+
+            if (code & 4) {
+                if (!masked.empty() && masked.back().start + masked.back().len == i)
+                    ++masked.back().len;
+                else
+                    masked.push_back({ i, 1 });
+            }
+            setCode(i, code & 3);
+        }
+    }
+
+    size_t size() const { return n; }
+    char fourthBase() const { return fourth; }
+
+    // Raw 2-bit code (ambiguous positions read as 0)
+    uint8_t codeAt(size_t i) const {
+        return (words[i >> 5] >> ((i & 31) * 2)) & 3;
+    }
+
+    char at(size_t i) const {
+        if (const Run* r = findRun(ambig, i))
+            return r->base;
+        const char letters[4] = { 'A', 'C', 'G', fourth };
+        char c = letters[codeAt(i)];
+        return findRun(masked, i) ? char(c - 'A' + 'a') : c;
+    }
+
+    char operator[](size_t i) const { return at(i); }
+
+    const pmr::vector<uint64_t>& packedWords() const { return words; }
+    const pmr::vector<Run>& ambiguityRuns() const { return ambig; }
+    const pmr::vector<Span>& maskRuns() const { return masked; }
+
+    allocator_type get_allocator() const { return words.get_allocator(); }
+
+    bool hasAmbiguity() const { return !ambig.empty(); }
+    bool hasMask() const { return !masked.empty(); }
+
+    // First position that is not an uppercase A/C/G/T(U), or npos
+    size_t firstIrregular() const {
+        size_t a = ambig.empty() ? validation::npos : ambig.front().start;
+        size_t m = masked.empty() ? validation::npos : masked.front().start;
+        return min(a, m);
+    }
+
+    /* Counts of A, C, G, T/U (any case), straight from the packed
+       words: with lo/hi the two bits of every code, code 3 is
+       lo & hi, code 2 is hi & ~lo, and so on, one popcount per
+       32 bases. Ambiguous positions are stored as code 0 and are
+       taken back out of A. */
+    array<uint64_t, 4> baseCounts() const {
+        const uint64_t LO = 0x5555555555555555ULL;
+        array<uint64_t, 4> counts{};
+        size_t full = n / 32;
+        for (size_t w = 0; w <= full && w < words.size(); ++w) {
+            uint64_t valid = (w < full) ? ~0ULL : ((1ULL << ((n % 32) * 2)) - 1);
+            uint64_t lo = words[w] & LO & valid;
+            uint64_t hi = (words[w] >> 1) & LO & valid;
+            counts[1] += __builtin_popcountll(lo & ~hi);
+            counts[2] += __builtin_popcountll(hi & ~lo);
+            counts[3] += __builtin_popcountll(lo & hi);
+        }
+        uint64_t ambiguous = 0;
+        for (const Run& r : ambig) ambiguous += r.len;
+        counts[0] = n - counts[1] - counts[2] - counts[3] - ambiguous;
+        return counts;
+    }
+
+    /* Composition of [from, from+len) from popcounts of the words:
+       with lo/hi the two bits of each code, C = lo&~hi, G = hi&~lo
+       and T = lo&hi; A is what is left after ambiguous bases. */
+    Composition composition(size_t from, size_t len) const {
+        const uint64_t LO = 0x5555555555555555ULL;
+        Composition c;
+        len = min(len, n > from ? n - from : 0);
+        if (len == 0) return c;
+        size_t end = from + len;
+        uint64_t prevC = 0;         // C at the last position of the previous word
+        for (size_t w = from >> 5; w <= (end - 1) >> 5; ++w) {
+            size_t lo = max(from, w * 32) - w * 32, hi = min(end, w * 32 + 32) - w * 32;
+            uint64_t valid = (hi - lo == 32) ? ~0ULL : (((1ULL << ((hi - lo) * 2)) - 1) << (lo * 2));
+            uint64_t bl = words[w] & LO & valid;
+            uint64_t bh = (words[w] >> 1) & LO & valid;
+            uint64_t cb = bl & ~bh, gb = bh & ~bl;
+            c.bases[1] += __builtin_popcountll(cb);
+            c.bases[2] += __builtin_popcountll(gb);
+            c.bases[3] += __builtin_popcountll(bl & bh);
+            c.cpg += __builtin_popcountll(cb & (gb >> 2)) + (prevC & gb & 1);
+            prevC = cb >> 62;
+        }
+        // Ambiguous positions are stored as code 0, so only A needs fixing
+        for (const Run& r : ambig) {
+            size_t s = max(r.start, from), e = min(r.start + r.len, end);
+            if (s < e) c.other += e - s;
+        }
+        c.bases[0] = len - c.bases[1] - c.bases[2] - c.bases[3] - c.other;
+        return c;
+    }
+
+    /* Reverse complement without unpacking: complementing a code
+       is code ^ 3, so each word is inverted and its codes reversed,
+       the word order flipped and the result shifted down over the
+       padding. Side-table runs are mirrored. */
+    void reverseComplement() {
+        size_t W = words.size();
+        if (n == 0) return;
+
+        reverse(words.begin(), words.end());
+        for (uint64_t& w : words) w = reverseCodes(~w);
+
+        size_t pad = W * 64 - n * 2;
+        if (pad) {
+            for (size_t k = 0; k + 1 < W; ++k)
+                words[k] = (words[k] >> pad) | (words[k + 1] << (64 - pad));
+            words[W - 1] >>= pad;
+        }
+
+        const array<char, 256>& comp = strand::complementTable(fourth);
+        for (Run& r : ambig) {
+            r.start = n - r.start - r.len;
+            r.base = comp[static_cast<unsigned char>(r.base)];
+        }
+        reverse(ambig.begin(), ambig.end());
+        for (Span& s : masked) s.start = n - s.start - s.len;
+        reverse(masked.begin(), masked.end());
+
+        // Keep ambiguous positions at code 0 (baseCounts relies on it)
+        for (const Run& r : ambig) clearCodes(r.start, r.len);
+    }
+
+    // Same bases read as DNA ('T') or RNA ('U'): only the letter changes
+    void setFourthBase(char t) { fourth = t; }
+
+    /* Uppercases every base: drops the soft-mask and uppercases the
+       ambiguity codes, merging runs that become equal ("nN" is one
+       run of N), so the result matches PackedBases(upper(text)) */
+    void toUpper() {
+        masked.clear();
+        size_t w = 0;
+        for (size_t r = 0; r < ambig.size(); ++r) {
+            Run run = ambig[r];
+            run.base = char(toupper(static_cast<unsigned char>(run.base)));
+            if (w > 0 && ambig[w - 1].base == run.base && ambig[w - 1].start + ambig[w - 1].len == run.start)
+                ambig[w - 1].len += run.len;
+            else
+                ambig[w++] = run;
+        }
+        ambig.resize(w);
+    }
+
+    /* Replaces [pos, pos+len) by text (any length): codes are moved a
+       word at a time and only the side-table runs near the edit are
+       rebuilt; runs after it are shifted. Returns the change in
+       sideTerms(), so a cached hash can be patched. */
+    uint64_t replace(size_t pos, size_t len, string_view text) {
+        pos = min(pos, n);
+        len = min(len, n - pos);
+        PackedBases fresh(text, fourth);
+        size_t n2 = n - len + text.size();
+
+        if (text.size() == len) {
+            copyCodes(fresh.words, 0, words, pos, len);
+        } else {
+            pmr::vector<uint64_t> out((n2 + 31) / 32, 0, words.get_allocator());
+            size_t head = min(min(words.size(), out.size()), pos / 32 + 1);
+            copy(words.begin(), words.begin() + ptrdiff_t(head), out.begin());
+            copyCodes(fresh.words, 0, out, pos, text.size());
+            copyCodes(words, pos + len, out, pos + text.size(), n - pos - len);
+            if (n2 % 32) out.back() &= (1ULL << (n2 % 32 * 2)) - 1;
+            words = move(out);
+        }
+
+        uint64_t delta = spliceRuns(ambig, pos, len, fresh.ambig, text.size(),
+                                    [](const Run& a, const Run& b) { return a.base == b.base; });
+        delta += spliceRuns(masked, pos, len, fresh.masked, text.size(),
+                            [](const Span&, const Span&) { return true; });
+        n = n2;
+        return delta;
+    }
+
+    /* Content hash terms: one per packed word (mixed with its index)
+       and one per side-table run, summed, so an edit can swap out
+       just the terms it touched */
+    uint64_t wordTerms(size_t fromWord, size_t toWord) const {
+        uint64_t h = 0;
+        for (size_t k = fromWord; k < min(toWord, words.size()); ++k)
+            h += mix(words[k] + (k + 1) * 0x9E3779B97F4A7C15ULL);
+        return h;
+    }
+
+    uint64_t sideTerms() const {
+        uint64_t h = 0;
+        for (const Run& r : ambig) h += term(r);
+        for (const Span& r : masked) h += term(r);
+        return h;
+    }
+
+    uint64_t contentHash(uint64_t wordSum, uint64_t sideSum, size_t length) const {
+        return mix(wordSum ^ mix(sideSum + length * 0xD6E8FEB86659FD93ULL + uint8_t(fourth)));
+    }
+
+    size_t memoryUsage() const {
+        return words.capacity() * sizeof(uint64_t)
+             + ambig.capacity() * sizeof(Run)
+             + masked.capacity() * sizeof(Span);
+    }
+
+    /* Forward iterator: unpacks one base at a time, walking the
+       side tables alongside so each step is amortized O(1). */
+    class const_iterator {
+    private:
+        const PackedBases* pb;
+        size_t i;
+        size_t ai;   // next candidate ambiguity run
+        size_t mi;   // next candidate mask run
+
+        void sync() {
+            while (ai < pb->ambig.size() && pb->ambig[ai].start + pb->ambig[ai].len <= i) ++ai;
+            while (mi < pb->masked.size() && pb->masked[mi].start + pb->masked[mi].len <= i) ++mi;
+        }
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = char;
+        using difference_type = ptrdiff_t;
+        using pointer = const char*;
+        using reference = char;
+
+        const_iterator(const PackedBases* p, size_t pos) : pb(p), i(pos), ai(0), mi(0) {
+            if (i > 0 && i < pb->n) {
+                ai = lower_bound(pb->ambig.begin(), pb->ambig.end(), i,
+                                 [](const Run& r, size_t pos) { return r.start + r.len <= pos; })
+                     - pb->ambig.begin();
+                mi = lower_bound(pb->masked.begin(), pb->masked.end(), i,
+                                 [](const Span& r, size_t pos) { return r.start + r.len <= pos; })
+                     - pb->masked.begin();
+            }
+        }
+
+        char operator*() const {
+            if (ai < pb->ambig.size() && pb->ambig[ai].start <= i)
+                return pb->ambig[ai].base;
+            const char letters[4] = { 'A', 'C', 'G', pb->fourth };
+            char c = letters[pb->codeAt(i)];
+            if (mi < pb->masked.size() && pb->masked[mi].start <= i)
+                c = char(c - 'A' + 'a');
+            return c;
+        }
+
+        const_iterator& operator++() { ++i; sync(); return *this; }
+        const_iterator operator++(int) { const_iterator t = *this; ++*this; return t; }
+
+        bool operator==(const const_iterator& o) const { return i == o.i; }
+        bool operator!=(const const_iterator& o) const { return i != o.i; }
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, n); }
+
+    /* Decodes [pos, pos+len) into out: a table expands each byte of
+       codes into four letters, then mask spans and ambiguity runs
+       overlapping the range are patched in. pos+len must be <= size(). */
+    void unpackInto(size_t pos, size_t len, char* out) const {
+        using Quad = array<char, 4>;
+        static const auto makeQuads = [](char t) {
+            array<Quad, 256> q;
+            const char letters[4] = { 'A', 'C', 'G', t };
+            for (unsigned b = 0; b < 256; ++b)
+                q[b] = { letters[b & 3], letters[(b >> 2) & 3], letters[(b >> 4) & 3], letters[b >> 6] };
+            return q;
+        };
+        static const array<Quad, 256> dnaQuads = makeQuads('T'), rnaQuads = makeQuads('U');
+        const array<Quad, 256>& quads = (fourth == 'U') ? rnaQuads : dnaQuads;
+        const char letters[4] = { 'A', 'C', 'G', fourth };
+
+        size_t i = pos, end = pos + len;
+        char* o = out;
+        for (; i < end && (i & 3); ++i) *o++ = letters[codeAt(i)];
+        for (; i + 4 <= end; i += 4, o += 4) {
+            uint8_t byte = uint8_t(words[i >> 5] >> ((i & 31) * 2));
+            memcpy(o, quads[byte].data(), 4);
+        }
+        for (; i < end; ++i) *o++ = letters[codeAt(i)];
+
+        auto overlapping = [pos](const auto& runs) {
+            return lower_bound(runs.begin(), runs.end(), pos,
+                               [](const auto& r, size_t p) { return r.start + r.len <= p; });
+        };
+        for (auto it = overlapping(masked); it != masked.end() && it->start < end; ++it)
+            for (size_t k = max(it->start, pos); k < min(it->start + it->len, end); ++k)
+                out[k - pos] = char(out[k - pos] - 'A' + 'a');
+        for (auto it = overlapping(ambig); it != ambig.end() && it->start < end; ++it) {
+            size_t from = max(it->start, pos), to = min(it->start + it->len, end);
+            memset(out + (from - pos), it->base, to - from);
+        }
+    }
+
+    // Unpacks [pos, pos+len) back to text
+    string unpack(size_t pos, size_t len) const {
+        len = min(len, n - min(pos, n));
+        string out(len, '\0');
+        if (len) unpackInto(min(pos, n), len, &out[0]);
+        return out;
+    }
+
+    string unpack() const { return unpack(0, n); }
+
+    // Streams [pos, pos+len) into a sink instead of materializing it
+    void write(OutputSink& out, size_t pos = 0, size_t len = SIZE_MAX) const {
+        len = min(len, n - min(pos, n));
+        pos = min(pos, n);
+        char buf[1 << 12];
+        for (size_t done = 0; done < len; ) {
+            size_t k = min(sizeof(buf), len - done);
+            unpackInto(pos + done, k, buf);
+            out.write(buf, k);
+            done += k;
+        }
+    }
+};
+
+/* ============================================================
+   Lifecycle tracing policy (compile time)
+   Build with -DLAB5_TRACE=0 (no-op), 1 (in-memory ring buffer)
+   or 2 (print every construction/destruction, as the labs have
+   always done). The default is 2 for debug builds and 0 when
+   NDEBUG is defined, so release builds pay nothing.
+   ============================================================ */
+#ifndef LAB5_TRACE
+#ifdef NDEBUG
+#define LAB5_TRACE 0
+#else
+#define LAB5_TRACE 2
+#endif
+#endif
+
+enum class LifeEvent : uint8_t { Created, Destroyed };
+
+struct NoTrace {
+    static void record(const char*, LifeEvent, const void*, const string* = nullptr) {}
+};
+
+struct VerboseTrace {
+    static void record(const char* type, LifeEvent ev, const void*, const string* name = nullptr) {
+        cout << type << (ev == LifeEvent::Created ? " created" : " destroyed");
+        if (name) cout << ": " << *name;
+        cout << '\n';
+    }
+};
+
+/* Lock-free ring of the most recent events. Writers claim a slot
+   with one fetch_add; a slot's stamp is published last, so
+   readers can skip slots that are mid-write or overwritten. */
+struct RingTrace {
+    struct Entry {
+        const char* type;   // string literal, never freed
+        const void* object;
+        LifeEvent event;
+        uint64_t seq;
+    };
+
+    static constexpr size_t CAPACITY = size_t(1) << 16;
+
+    struct Slot {
+        atomic<uint64_t> stamp{ 0 };    // seq + 1 once written
+        atomic<const char*> type{ nullptr };
+        atomic<const void*> object{ nullptr };
+        atomic<LifeEvent> event{ LifeEvent::Created };
+    };
+
+    static Slot* slots() {
+        static Slot ring[CAPACITY];
+        return ring;
+    }
+
+    static atomic<uint64_t>& head() {
+        static atomic<uint64_t> h{ 0 };
+        return h;
+    }
+
+    static void record(const char* type, LifeEvent ev, const void* obj, const string* = nullptr) {
+        uint64_t seq = head().fetch_add(1, memory_order_relaxed);
+        Slot& s = slots()[seq & (CAPACITY - 1)];
+        s.stamp.store(0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        s.type.store(type, memory_order_relaxed);
+        s.object.store(obj, memory_order_relaxed);
+        s.event.store(ev, memory_order_relaxed);
+        s.stamp.store(seq + 1, memory_order_release);
+    }
+
+    // Oldest to newest of the events still in the ring
+    static vector<Entry> snapshot() {
+        uint64_t last = head().load(memory_order_acquire);
+        uint64_t first = last > CAPACITY ? last - CAPACITY : 0;
+        vector<Entry> out;
+        out.reserve(last - first);
+        for (uint64_t seq = first; seq < last; ++seq) {
+            const Slot& s = slots()[seq & (CAPACITY - 1)];
+            if (s.stamp.load(memory_order_acquire) != seq + 1) continue;
+            Entry e{ s.type.load(memory_order_relaxed), s.object.load(memory_order_relaxed),
+                     s.event.load(memory_order_relaxed), seq };
+            atomic_thread_fence(memory_order_acquire);
+            if (s.stamp.load(memory_order_relaxed) == seq + 1)
+                out.push_back(e);
+        }
+        return out;
+    }
+
+    static void dump(ostream& os) {
+        for (const Entry& e : snapshot())
+            os << '#' << e.seq << ' ' << e.type
+               << (e.event == LifeEvent::Created ? " created " : " destroyed ")
+               << e.object << '\n';
+    }
+};
+
+#if LAB5_TRACE == 0
+using LifecycleTrace = NoTrace;
+#elif LAB5_TRACE == 1
+using LifecycleTrace = RingTrace;
+#else
+using LifecycleTrace = VerboseTrace;
+#endif
+
+enum class SequenceKind : uint8_t { DNA, RNA, Protein };
+
+/* ============================================================
+   Abstract Base Class: Sequence
+   ============================================================ */
+class Sequence {
+public:
+    using allocator_type = SeqAllocator;
+
+protected:
+    pmr::string data;
+
+    // For subclasses that keep their bases elsewhere
+    Sequence(const allocator_type& a = {}) : data(a) {
+        LifecycleTrace::record("Sequence", LifeEvent::Created, this);
+    }
+
+    // Copy/move into a given arena (see SequenceArena)
+    Sequence(const Sequence& o, const allocator_type& a) : data(o.data, a) {}
+    Sequence(Sequence&& o, const allocator_type& a) : data(move(o.data), a) {}
+
+public:
+    Sequence(string_view d, const allocator_type& a = {}) : data(d, a) {
+        LifecycleTrace::record("Sequence", LifeEvent::Created, this);
+    }
+
+    // The virtual destructor suppresses the implicit moves, so they
+    // are spelled out for the whole hierarchy
+    Sequence(const Sequence&) = default;
+    Sequence(Sequence&&) noexcept = default;
+    Sequence& operator=(const Sequence&) = default;
+    Sequence& operator=(Sequence&&) = default;
+
+    virtual ~Sequence() {
+        LifecycleTrace::record("Sequence", LifeEvent::Destroyed, this);
+    }
+
+    // Pure virtual methods → Sequence becomes abstract
+    virtual void describe(OutputSink& out) const = 0;
+    virtual bool isValid() const = 0;
+
+    // Offset of the first invalid symbol, or validation::npos
+    virtual size_t firstInvalid() const = 0;
+
+    // Concrete type, so batch code can group items and skip the vtable
+    virtual SequenceKind kind() const = 0;
+
+    virtual size_t length() const {
+        return data.size();
+    }
+
+    // describe() on standard output
+    void describe() const {
+        StreamSink out(cout);
+        describe(out);
+    }
+};
+
+/* ============================================================
+   RefView: a window onto FASTA text held elsewhere (e.g. an
+   mmap'd reference), addressed through the record's .fai line
+   geometry so line breaks never have to be copied out.
+   ============================================================ */
+struct RefView {
+    const char* text = nullptr;     // first base of the record
+    size_t lineBases = 0;           // bases per full line
+    size_t lineWidth = 0;           // bytes per full line incl. newline
+    size_t start = 0;               // first base of the window
+    size_t len = 0;
+
+    char at(size_t i) const {
+        size_t p = start + i;
+        return text[p / lineBases * lineWidth + p % lineBases];
+    }
+
+    // Calls f(ptr, n) for each contiguous piece of the window
+    template <typename F>
+    void forEachChunk(F f) const {
+        size_t p = start, left = len;
+        while (left) {
+            size_t col = p % lineBases;
+            size_t take = min(left, lineBases - col);
+            f(text + p / lineBases * lineWidth + col, take);
+            p += take;
+            left -= take;
+        }
+    }
+
+    size_t firstInvalid(const ByteClass& cls) const {
+        size_t offset = 0, found = validation::npos;
+        size_t p = start, left = len;
+        while (left && found == validation::npos) {
+            size_t col = p % lineBases;
+            size_t take = min(left, lineBases - col);
+            size_t bad = validation::findInvalid(text + p / lineBases * lineWidth + col, take, cls);
+            if (bad < take) found = offset + bad;
+            offset += take;
+            p += take;
+            left -= take;
+        }
+        return found;
+    }
+};
+
+class FMIndex;
+
+/* ============================================================
+   Intermediate Class: NucleotideSequence
+   DNA and RNA keep their bases 2-bit packed instead of in the
+   inherited data string (which stays empty), or borrow them
+   from a RefView without copying.
+   ============================================================ */
+class NucleotideSequence : public Sequence {
+public:
+    // A stretch edited since clearDirty(), in current coordinates;
+    // len 0 marks a deletion point
+    struct DirtyRange { size_t start; size_t len; };
+
+protected:
+    /* Derived properties, each filled on first use. The snapshot is
+       immutable and shared by copies; edits replace it with one
+       patched from the edited window alone. */
+    struct Derived {
+        Composition composition;
+        uint64_t wordTerms = 0;         // hash terms, see PackedBases::wordTerms
+        uint64_t sideTerms = 0;
+        size_t firstInvalid = validation::npos;     // views only
+        bool hasComposition = false;
+        bool hasHash = false;
+        bool hasFirstInvalid = false;
+    };
+
+    PackedBases bases;
+    RefView ref;            // used instead of bases when borrowed
+    bool borrowed = false;
+    shared_ptr<const FMIndex> fm;   // optional search index over the bases
+    mutable shared_ptr<const Derived> derived;
+    vector<DirtyRange> dirty;
+    uint64_t revisionCount = 0;
+
+    static constexpr size_t MAX_DIRTY_RANGES = 64;
+
+    // The cache with one part filled in; concurrent readers may both
+    // compute it, and the loser recomputes over the winner's snapshot
+    template <typename F>
+    shared_ptr<const Derived> cached(bool Derived::*has, F fill) const {
+        shared_ptr<const Derived> cur = atomic_load(&derived);
+        while (!cur || !((*cur).*has)) {
+            auto next = make_shared<Derived>(cur ? *cur : Derived());
+            fill(*next);
+            (*next).*has = true;
+            shared_ptr<const Derived> done = next;
+            if (atomic_compare_exchange_strong(&derived, &cur, done)) return done;
+        }
+        return cur;
+    }
+
+    void recordEdit(size_t pos, size_t len, size_t newLen) {
+        ++revisionCount;
+        // Ranges touching the edit merge into it; later ones shift
+        size_t s = pos, e = pos + newLen;
+        auto mapped = [&](size_t x) { return x <= pos ? x : x >= pos + len ? x - len + newLen : pos + newLen; };
+        vector<DirtyRange> out;
+        out.reserve(dirty.size() + 1);
+        bool placed = false;
+        for (const DirtyRange& d : dirty) {
+            if (d.start + d.len < pos) {
+                out.push_back(d);
+            } else if (d.start > pos + len) {
+                if (!placed) { out.push_back({ s, e - s }); placed = true; }
+                out.push_back({ mapped(d.start), d.len });
+            } else {
+                s = min(s, d.start);
+                e = max(e, mapped(d.start + d.len));
+            }
+        }
+        if (!placed) out.push_back({ s, e - s });
+        if (out.size() > MAX_DIRTY_RANGES) {
+            size_t first = out.front().start, last = out.back().start + out.back().len;
+            out.assign(1, DirtyRange{ first, last - first });
+        }
+        dirty = move(out);
+    }
+
+    NucleotideSequence(string_view d, char fourth, const allocator_type& a)
+        : Sequence(a), bases(d, fourth, a) {}
+
+    NucleotideSequence(const RefView& v)
+        : Sequence(), ref(v), borrowed(true) {}
+
+    NucleotideSequence(PackedBases&& pb, char fourth)
+        : Sequence(pb.get_allocator()), bases(move(pb)) {
+        bases.setFourthBase(fourth);
+    }
+
+    // Packed copy of the bases, reverse complemented if asked
+    PackedBases packedCopy(bool revcomp) const {
+        PackedBases pb;
+        if (borrowed) {
+            string text = str();
+            if (revcomp) strand::reverseComplementInPlace(&text[0], text.size(), bases.fourthBase());
+            pb = PackedBases(text, bases.fourthBase());
+        } else {
+            pb = bases;
+            if (revcomp) pb.reverseComplement();
+        }
+        return pb;
+    }
+
+    NucleotideSequence(const NucleotideSequence& o, const allocator_type& a)
+        : Sequence(o, a), bases(o.bases, a), ref(o.ref), borrowed(o.borrowed), fm(o.fm),
+          derived(atomic_load(&o.derived)), dirty(o.dirty), revisionCount(o.revisionCount) {}
+
+    NucleotideSequence(NucleotideSequence&& o, const allocator_type& a)
+        : Sequence(move(o), a), bases(move(o.bases), a), ref(o.ref), borrowed(o.borrowed),
+          fm(move(o.fm)), derived(move(o.derived)), dirty(move(o.dirty)),
+          revisionCount(o.revisionCount) {}
+
+public:
+    // Bases [pos, pos+len) of either storage, without unpacking them all
+    void writeBases(OutputSink& out, size_t pos = 0, size_t len = SIZE_MAX) const {
+        if (!borrowed) {
+            bases.write(out, pos, len);
+            return;
+        }
+        RefView part = ref;
+        part.start += min(pos, ref.len);
+        part.len = min(len, ref.len - min(pos, ref.len));
+        part.forEachChunk([&out](const char* p, size_t n) { out.write(p, n); });
+    }
+
+    // Copies read the cache atomically: const readers of o may be filling it
+    NucleotideSequence(const NucleotideSequence& o)
+        : Sequence(o), bases(o.bases), ref(o.ref), borrowed(o.borrowed), fm(o.fm),
+          derived(atomic_load(&o.derived)), dirty(o.dirty), revisionCount(o.revisionCount) {}
+    NucleotideSequence(NucleotideSequence&&) noexcept = default;
+
+    NucleotideSequence& operator=(const NucleotideSequence& o) {
+        if (this == &o) return *this;
+        Sequence::operator=(o);
+        bases = o.bases;
+        ref = o.ref;
+        borrowed = o.borrowed;
+        fm = o.fm;
+        derived = atomic_load(&o.derived);
+        dirty = o.dirty;
+        revisionCount = o.revisionCount;
+        return *this;
+    }
+    NucleotideSequence& operator=(NucleotideSequence&&) = default;
+
+    size_t length() const override {
+        return borrowed ? ref.len : bases.size();
+    }
+
+    // Valid = only uppercase A, C, G and T/U
+    bool isValid() const override {
+        return firstInvalid() == validation::npos;
+    }
+
+    // Packed storage reads this off its side tables; a view is scanned once
+    size_t firstInvalid() const override {
+        if (!borrowed)
+            return bases.firstIrregular();
+        return cached(&Derived::hasFirstInvalid, [this](Derived& d) {
+            d.firstInvalid = ref.firstInvalid(bases.fourthBase() == 'U' ? validation::rnaClass()
+                                                                        : validation::dnaClass());
+        })->firstInvalid;
+    }
+
+    char at(size_t i) const { return borrowed ? ref.at(i) : bases.at(i); }
+    char operator[](size_t i) const { return at(i); }
+
+    // Iterates either storage; packed bases unpack on the fly
+    class const_iterator {
+    private:
+        const NucleotideSequence* seq;
+        PackedBases::const_iterator it;
+        size_t i;
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = char;
+        using difference_type = ptrdiff_t;
+        using pointer = const char*;
+        using reference = char;
+
+        const_iterator(const NucleotideSequence* s, size_t pos)
+            : seq(s), it(&s->bases, s->borrowed ? 0 : pos), i(pos) {}
+
+        char operator*() const { return seq->borrowed ? seq->ref.at(i) : *it; }
+
+        const_iterator& operator++() {
+            ++i;
+            if (!seq->borrowed) ++it;
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator t = *this; ++*this; return t; }
+
+        bool operator==(const const_iterator& o) const { return i == o.i; }
+        bool operator!=(const const_iterator& o) const { return i != o.i; }
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, length()); }
+
+    string substr(size_t pos, size_t len) const {
+        if (!borrowed)
+            return bases.unpack(pos, len);
+        RefView part = ref;
+        part.start += min(pos, ref.len);
+        part.len = min(len, ref.len - min(pos, ref.len));
+        string out;
+        out.reserve(part.len);
+        part.forEachChunk([&out](const char* p, size_t n) { out.append(p, n); });
+        return out;
+    }
+
+    string str() const { return substr(0, length()); }
+
+    /* Edits: [pos, pos+len) becomes text, so a substitution keeps the
+       length and an insertion (len 0) or deletion (empty text) shifts
+       the rest. A borrowed view is packed first. Cached properties are
+       patched from the edited window plus one base on each side (for
+       CpG pairs across its edges); only length changes touch the rest,
+       to move it. The FM-index is dropped. */
+    void replace(size_t pos, size_t len, string_view text) {
+        if (pos > length()) throw out_of_range("NucleotideSequence: edit past the end");
+        len = min(len, length() - pos);
+        if (len == 0 && text.empty()) return;
+
+        fm.reset();
+        if (borrowed) {
+            bases = packedCopy(false);
+            borrowed = false;
+        }
+
+        size_t n = bases.size(), n2 = n - len + text.size();
+        size_t from = pos ? pos - 1 : 0;
+        size_t firstWord = pos / 32;
+        size_t lastWord = (len == text.size()) ? (pos + len + 31) / 32 : (n + 31) / 32;
+        shared_ptr<const Derived> old = derived;
+        Composition before;
+        uint64_t wordsBefore = 0;
+        if (old && old->hasComposition) before = bases.composition(from, min(n, pos + len + 1) - from);
+        if (old && old->hasHash) wordsBefore = bases.wordTerms(firstWord, lastWord);
+
+        uint64_t sideDelta = bases.replace(pos, len, text);
+
+        if (old) {
+            Derived d = *old;
+            if (d.hasComposition) {
+                d.composition -= before;
+                d.composition += bases.composition(from, min(n2, pos + text.size() + 1) - from);
+            }
+            if (d.hasHash) {
+                if (len != text.size()) lastWord = (n2 + 31) / 32;
+                d.wordTerms += bases.wordTerms(firstWord, lastWord) - wordsBefore;
+                d.sideTerms += sideDelta;
+            }
+            d.hasFirstInvalid = false;
+            derived = make_shared<const Derived>(d);
+        }
+        recordEdit(pos, len, text.size());
+    }
+
+    void setBase(size_t pos, char c) {
+        if (pos >= length()) throw out_of_range("NucleotideSequence: edit past the end");
+        replace(pos, 1, string_view(&c, 1));
+    }
+    void insert(size_t pos, string_view text) { replace(pos, 0, text); }
+    void erase(size_t pos, size_t len) { replace(pos, len, string_view()); }
+
+    // Bumped by every edit, so callers can tell whether their results are stale
+    uint64_t revision() const { return revisionCount; }
+
+    // Edited stretches since the last clearDirty(), merged and sorted;
+    // past MAX_DIRTY_RANGES they collapse into one covering range
+    const vector<DirtyRange>& dirtyRanges() const { return dirty; }
+    void clearDirty() { dirty.clear(); }
+
+    // Order-sensitive 64-bit hash of the text (case and ambiguity codes
+    // included); equal for a view and its packed copy
+    uint64_t contentHash() const {
+        shared_ptr<const Derived> d = cached(&Derived::hasHash, [this](Derived& c) {
+            PackedBases scratch;
+            const PackedBases& pb = packedBases(scratch);
+            c.wordTerms = pb.wordTerms(0, pb.packedWords().size());
+            c.sideTerms = pb.sideTerms();
+        });
+        return bases.contentHash(d->wordTerms, d->sideTerms, length());
+    }
+
+    // In-place strand operations; a borrowed view is packed first
+    void reverseComplementInPlace() {
+        derived.reset();
+        recordEdit(0, length(), length());
+        fm.reset();
+        if (borrowed) {
+            bases = packedCopy(true);
+            borrowed = false;
+        } else {
+            bases.reverseComplement();
+        }
+    }
+
+    void toUpperInPlace() {
+        if (shared_ptr<const Derived> old = derived) {
+            // Case does not change the composition
+            Derived d;
+            d.composition = old->composition;
+            d.hasComposition = old->hasComposition;
+            derived = make_shared<const Derived>(d);
+        }
+        recordEdit(0, length(), length());
+        if (borrowed) {
+            string text = str();
+            strand::toUpper(&text[0], text.size());
+            bases = PackedBases(text, bases.fourthBase(), bases.get_allocator());
+            borrowed = false;
+        } else {
+            bases.toUpper();
+        }
+    }
+
+    bool isView() const { return borrowed; }
+    const RefView& view() const { return ref; }
+
+    /* Optional FM-index for motif search; shared between copies
+       and dropped when the bases change (case does not matter) */
+    void buildIndex(uint32_t sampleRate = 32);
+    void attachIndex(shared_ptr<const FMIndex> index);
+    const shared_ptr<const FMIndex>& attachedIndex() const { return fm; }
+
+    // Occurrences of an A/C/G/T(U) motif, case-insensitive, overlaps
+    // included; uses the index when one is attached, else scans
+    size_t countMotif(string_view motif) const;
+    vector<size_t> findMotif(string_view motif) const;
+    const PackedBases& packed() const { return bases; }
+
+    // Packed bases of either storage; a view is packed into scratch
+    const PackedBases& packedBases(PackedBases& scratch) const {
+        if (!borrowed) return bases;
+        scratch = PackedBases(str(), bases.fourthBase());
+        return scratch;
+    }
+
+    // Cached; see replace() for how edits keep it current
+    Composition composition() const {
+        return cached(&Derived::hasComposition, [this](Derived& d) {
+            if (!borrowed) {
+                d.composition = bases.composition(0, bases.size());
+                return;
+            }
+            bool prevC = false;
+            char fourth = bases.fourthBase();
+            ref.forEachChunk([&](const char* p, size_t n) {
+                stats::countText(p, n, d.composition, prevC, fourth);
+            });
+        })->composition;
+    }
+
+    /* GC fraction of windows [s, s+window) for s = 0, step, 2*step...
+       below length(), ending with the first window that reaches the
+       end (which may be shorter). NaN for windows with no A/C/G/T. */
+    vector<float> gcProfile(size_t window, size_t step) const {
+        if (window == 0 || step == 0) throw invalid_argument("gcProfile: window and step must be > 0");
+        PackedBases scratch;
+        const PackedBases& pb = packedBases(scratch);
+        vector<float> out;
+        size_t n = pb.size();
+        if (n == 0) return out;
+        out.reserve((n - 1) / step + 1);
+        for (size_t s = 0; s < n; s += step) {
+            size_t len = min(window, n - s);
+            out.push_back(float(pb.composition(s, len).gc()));
+            if (s + len == n) break;
+        }
+        return out;
+    }
+
+    // Counts of A, C, G, T/U in either case; taken from the cache when
+    // composition() has filled it, else counted without touching it
+    array<uint64_t, 4> baseCounts() const {
+        if (shared_ptr<const Derived> d = atomic_load(&derived); d && d->hasComposition)
+            return d->composition.bases;
+        return countBases();
+    }
+
+    // baseCounts() straight from the storage, for batch kernels that
+    // see each sequence once
+    array<uint64_t, 4> countBases() const {
+        if (!borrowed)
+            return bases.baseCounts();
+        array<uint64_t, 4> counts{};
+        const array<uint8_t, 256>& table = PackedBases::codeTable(bases.fourthBase());
+        ref.forEachChunk([&](const char* p, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                uint8_t code = table[static_cast<unsigned char>(p[i])];
+                if (code != PackedBases::INVALID) ++counts[code & 3];
+            }
+        });
+        return counts;
+    }
+};
+
+class RNASequence;
+
+/* ============================================================
+   Derived Class: DNASequence
+   ============================================================ */
+class DNASequence final : public NucleotideSequence {
+public:
+    DNASequence(string_view d, const allocator_type& a = {})
+        : NucleotideSequence(d, 'T', a) {
+        LifecycleTrace::record("DNASequence", LifeEvent::Created, this);
+    }
+
+    // Zero-copy: borrows the bases, nothing is allocated
+    DNASequence(const RefView& v) : NucleotideSequence(v) {
+        LifecycleTrace::record("DNASequence", LifeEvent::Created, this);
+    }
+
+    // Adopts packed bases (read as DNA)
+    explicit DNASequence(PackedBases pb) : NucleotideSequence(move(pb), 'T') {
+        LifecycleTrace::record("DNASequence", LifeEvent::Created, this);
+    }
+
+    DNASequence(const DNASequence&) = default;
+    DNASequence(DNASequence&&) noexcept = default;
+    DNASequence& operator=(const DNASequence&) = default;
+    DNASequence& operator=(DNASequence&&) = default;
+
+    DNASequence(const DNASequence& o, const allocator_type& a) : NucleotideSequence(o, a) {}
+    DNASequence(DNASequence&& o, const allocator_type& a) : NucleotideSequence(move(o), a) {}
+
+    ~DNASequence() override {
+        LifecycleTrace::record("DNASequence", LifeEvent::Destroyed, this);
+    }
+
+    SequenceKind kind() const override { return SequenceKind::DNA; }
+
+    using Sequence::describe;
+    void describe(OutputSink& out) const override {
+        out << "DNA sequence: ";
+        writeBases(out);
+        out << '\n';
+    }
+
+    DNASequence reverseComplement() const { return DNASequence(packedCopy(true)); }
+
+    // T -> U; on packed bases this is a copy of the words
+    RNASequence transcribe() const;
+};
+
+/* ============================================================
+   Derived Class: RNASequence
+   ============================================================ */
+class RNASequence final : public NucleotideSequence {
+public:
+    RNASequence(string_view d, const allocator_type& a = {})
+        : NucleotideSequence(d, 'U', a) {
+        LifecycleTrace::record("RNASequence", LifeEvent::Created, this);
+    }
+
+    // Adopts packed bases (read as RNA)
+    explicit RNASequence(PackedBases pb) : NucleotideSequence(move(pb), 'U') {
+        LifecycleTrace::record("RNASequence", LifeEvent::Created, this);
+    }
+
+    RNASequence(const RNASequence&) = default;
+    RNASequence(RNASequence&&) noexcept = default;
+    RNASequence& operator=(const RNASequence&) = default;
+    RNASequence& operator=(RNASequence&&) = default;
+
+    RNASequence(const RNASequence& o, const allocator_type& a) : NucleotideSequence(o, a) {}
+    RNASequence(RNASequence&& o, const allocator_type& a) : NucleotideSequence(move(o), a) {}
+
+    ~RNASequence() override {
+        LifecycleTrace::record("RNASequence", LifeEvent::Destroyed, this);
+    }
+
+    SequenceKind kind() const override { return SequenceKind::RNA; }
+
+    using Sequence::describe;
+    void describe(OutputSink& out) const override {
+        out << "RNA sequence: ";
+        writeBases(out);
+        out << '\n';
+    }
+
+    RNASequence reverseComplement() const { return RNASequence(packedCopy(true)); }
+
+    // U -> T
+    DNASequence reverseTranscribe() const { return DNASequence(packedCopy(false)); }
+};
+
+inline RNASequence DNASequence::transcribe() const {
+    return RNASequence(packedCopy(false));
+}
+
+/* ============================================================
+   StrandView: lazy reverse-complemented and/or transcribed view
+   of a nucleotide sequence. Nothing is computed until a base is
+   read; str() materializes with the vector kernels.
+   ============================================================ */
+class StrandView {
+private:
+    const NucleotideSequence* seq;
+    bool revcomp;
+    char fromFourth;
+    char toFourth;
+
+public:
+    StrandView(const NucleotideSequence& s, bool reverseComplement, char fourth)
+        : seq(&s), revcomp(reverseComplement),
+          fromFourth(s.packed().fourthBase()), toFourth(fourth) {}
+
+    static StrandView reverseComplement(const DNASequence& s) { return StrandView(s, true, 'T'); }
+    static StrandView reverseComplement(const RNASequence& s) { return StrandView(s, true, 'U'); }
+    static StrandView transcript(const DNASequence& s) { return StrandView(s, false, 'U'); }
+
+    size_t size() const { return seq->length(); }
+
+    char operator[](size_t i) const {
+        if (!revcomp) {
+            char c = seq->at(i);
+            if ((c | 0x20) == (fromFourth | 0x20)) c = char(c - fromFourth + toFourth);
+            return c;
+        }
+        return strand::complementTable(toFourth)[static_cast<unsigned char>(seq->at(size() - 1 - i))];
+    }
+
+    string str() const {
+        string text = seq->str();
+        if (revcomp)
+            strand::reverseComplementInPlace(&text[0], text.size(), toFourth);
+        else if (fromFourth == 'T' && toFourth == 'U')
+            strand::transcribe(&text[0], text.size());
+        else if (fromFourth == 'U' && toFourth == 'T')
+            strand::reverseTranscribe(&text[0], text.size());
+        return text;
+    }
+};
+
+/* ============================================================
+   Derived Class: ProteinSequence
+   ============================================================ */
+class ProteinSequence final : public Sequence {
+public:
+    ProteinSequence(string_view d, const allocator_type& a = {}) : Sequence(d, a) {
+        LifecycleTrace::record("ProteinSequence", LifeEvent::Created, this);
+    }
+
+    ProteinSequence(const ProteinSequence&) = default;
+    ProteinSequence(ProteinSequence&&) noexcept = default;
+    ProteinSequence& operator=(const ProteinSequence&) = default;
+    ProteinSequence& operator=(ProteinSequence&&) = default;
+
+    ProteinSequence(const ProteinSequence& o, const allocator_type& a) : Sequence(o, a) {}
+    ProteinSequence(ProteinSequence&& o, const allocator_type& a) : Sequence(move(o), a) {}
+
+    ~ProteinSequence() override {
+        LifecycleTrace::record("ProteinSequence", LifeEvent::Destroyed, this);
+    }
+
+    SequenceKind kind() const override { return SequenceKind::Protein; }
+
+    using Sequence::describe;
+    void describe(OutputSink& out) const override {
+        out << "Protein sequence: " << string_view(data) << '\n';
+    }
+
+    bool isValid() const override {
+        return firstInvalid() == validation::npos;
+    }
+
+    size_t firstInvalid() const override {
+        return validation::firstInvalid(data, validation::proteinClass());
+    }
+
+    string_view residues() const { return data; }
+
+    AminoAcidComposition composition() const { return stats::countResidues(data); }
+};
+
+/* ============================================================
+   AnySequence: compile-time dispatched alternative to Sequence*
+   Holds one of the three concrete types by value in a variant,
+   so a vector<AnySequence> is contiguous and every call resolves
+   to the concrete (final) class at compile time. The API
+   mirrors Sequence.
+   ============================================================ */
+class AnySequence {
+private:
+    variant<DNASequence, RNASequence, ProteinSequence> seq;
+
+public:
+    AnySequence(DNASequence s) : seq(move(s)) {}
+    AnySequence(RNASequence s) : seq(move(s)) {}
+    AnySequence(ProteinSequence s) : seq(move(s)) {}
+
+    template <typename T, typename... Args>
+    static AnySequence make(Args&&... args) {
+        return AnySequence(in_place_type<T>, forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    AnySequence(in_place_type_t<T> t, Args&&... args) : seq(t, forward<Args>(args)...) {}
+
+    // Calls f with the concrete sequence type
+    template <typename F>
+    decltype(auto) visit(F&& f) const { return std::visit(forward<F>(f), seq); }
+
+    template <typename F>
+    decltype(auto) visit(F&& f) { return std::visit(forward<F>(f), seq); }
+
+    void describe() const { visit([](const auto& s) { s.describe(); }); }
+    void describe(OutputSink& out) const { visit([&out](const auto& s) { s.describe(out); }); }
+    bool isValid() const { return visit([](const auto& s) { return s.isValid(); }); }
+    size_t firstInvalid() const { return visit([](const auto& s) { return s.firstInvalid(); }); }
+    size_t length() const { return visit([](const auto& s) { return s.length(); }); }
+    SequenceKind kind() const { return SequenceKind(seq.index()); }
+
+    template <typename T>
+    const T* get() const { return get_if<T>(&seq); }
+};
+
+// Visitor-based algorithms over any range of AnySequence
+template <typename Range>
+size_t countValid(const Range& seqs) {
+    size_t n = 0;
+    for (const AnySequence& s : seqs) n += s.isValid();
+    return n;
+}
+
+template <typename Range>
+uint64_t totalLength(const Range& seqs) {
+    uint64_t n = 0;
+    for (const AnySequence& s : seqs) n += s.length();
+    return n;
+}
+
+/* ============================================================
+   SeqRecord: one FASTA/FASTQ record as views into the reader's
+   buffer. The views stay valid until the next call to next();
+   Sequence objects are only built when asked for.
+   ============================================================ */
+struct SeqRecord {
+    string_view name;
+    string_view comment;
+    string_view seq;
+    string_view qual;       // empty for FASTA
+
+    DNASequence toDNA(const SeqAllocator& a = {}) const { return DNASequence(seq, a); }
+    RNASequence toRNA(const SeqAllocator& a = {}) const { return RNASequence(seq, a); }
+    ProteinSequence toProtein(const SeqAllocator& a = {}) const { return ProteinSequence(seq, a); }
+};
+
+/* ============================================================
+   SequenceReader: streaming FASTA/FASTQ parser
+   Reads fixed-size chunks into one buffer that only grows to
+   fit the largest single record. Multi-line records are joined
+   in place, so each record costs no allocation. With
+   LAB5_WITH_ZLIB defined (link with -lz) gzip input is
+   decompressed transparently.
+   Memory is bounded by the largest record, not the chunk size:
+   a genome FASTA holds a whole chromosome (~250 MB for chr1) in
+   the buffer at once. maxRecord caps the buffer, and a larger
+   record throws instead; ReferenceStore maps such files without
+   reading them.
+   ============================================================ */
+class SequenceReader {
+private:
+#ifdef LAB5_WITH_ZLIB
+    gzFile in = nullptr;
+#else
+    FILE* in = nullptr;
+#endif
+    vector<char> buf;
+    size_t maxBuffer;       // bytes one record may take, as stored
+    size_t beg = 0;         // start of unconsumed data
+    size_t end = 0;         // end of valid data
+    bool eof = false;
+
+    size_t readRaw(char* dst, size_t n) {
+#ifdef LAB5_WITH_ZLIB
+        int got = gzread(in, dst, static_cast<unsigned>(min(n, size_t(1) << 30)));
+        if (got < 0) throw runtime_error("SequenceReader: gzip read error");
+        return static_cast<size_t>(got);
+#else
+        return fread(dst, 1, n, in);
+#endif
+    }
+
+    // Moves unconsumed bytes to the front, grows the buffer if it is
+    // full, and reads more. Offsets relative to beg stay valid.
+    bool fill() {
+        if (eof) return false;
+        if (beg > 0) {
+            memmove(buf.data(), buf.data() + beg, end - beg);
+            end -= beg;
+            beg = 0;
+        }
+        if (end == buf.size()) {
+            if (buf.size() >= maxBuffer)
+                throw runtime_error("SequenceReader: record longer than " + to_string(maxBuffer) + " bytes");
+            buf.resize(min(buf.size() * 2, max(maxBuffer, buf.size())));
+        }
+
+        size_t got = readRaw(buf.data() + end, buf.size() - end);
+        if (got == 0) eof = true;
+        end += got;
+        return got > 0;
+    }
+
+    // Offset (relative to beg) of the next '\n' at or after from, or npos
+    size_t findNewline(size_t from) const {
+        const char* base = buf.data() + beg;
+        const void* p = memchr(base + from, '\n', (end - beg) - from);
+        return p ? static_cast<const char*>(p) - base : validation::npos;
+    }
+
+    // Removes line breaks from [from, to) in place; returns the new end
+    size_t joinLines(size_t from, size_t to) {
+        char* base = buf.data() + beg;
+        size_t w = from;
+        for (size_t r = from; r < to; ) {
+            const void* p = memchr(base + r, '\n', to - r);
+            size_t stop = p ? static_cast<const char*>(p) - base : to;
+            size_t len = stop - r;
+            if (len && base[r + len - 1] == '\r') --len;
+            memmove(base + w, base + r, len);
+            w += len;
+            r = stop + 1;
+        }
+        return w;
+    }
+
+    void splitHeader(SeqRecord& rec, size_t from, size_t to) {
+        const char* base = buf.data() + beg;
+        if (to > from && base[to - 1] == '\r') --to;
+        string_view h(base + from, to - from);
+        size_t ws = h.find_first_of(" \t");
+        rec.name = h.substr(0, ws);
+        rec.comment = (ws == string_view::npos) ? string_view()
+                                                : h.substr(h.find_first_not_of(" \t", ws));
+    }
+
+    bool nextFasta(SeqRecord& rec) {
+        size_t hdrEnd = validation::npos;
+        size_t scan = 1;
+        size_t recEnd;
+
+        for (;;) {
+            size_t avail = end - beg;
+            size_t nl = findNewline(scan);
+
+            if (nl == validation::npos || nl + 1 == avail) {
+                // Record may continue past the buffer
+                scan = (nl == validation::npos) ? avail : nl;
+                if (!fill()) { recEnd = end - beg; break; }
+                continue;
+            }
+            if (hdrEnd == validation::npos) hdrEnd = nl;
+            if (buf[beg + nl + 1] == '>') { recEnd = nl + 1; break; }
+            scan = nl + 1;
+        }
+
+        if (hdrEnd == validation::npos) hdrEnd = findNewline(1);
+        if (hdrEnd == validation::npos) hdrEnd = recEnd;
+
+        splitHeader(rec, 1, hdrEnd);
+        size_t seqStart = min(hdrEnd + 1, recEnd);
+        size_t seqEnd = joinLines(seqStart, recEnd);
+        rec.seq = string_view(buf.data() + beg + seqStart, seqEnd - seqStart);
+        rec.qual = string_view();
+        beg += recEnd;
+        return true;
+    }
+
+    // FASTQ records are short, so an incomplete record is simply
+    // re-parsed from its start after the buffer is refilled.
+    bool nextFastq(SeqRecord& rec) {
+        for (;;) {
+            const char* base = buf.data() + beg;
+            size_t avail = end - beg;
+
+            size_t hdrEnd = findNewline(1);
+            size_t seqStart = hdrEnd + 1, seqLen = 0, p = seqStart;
+            size_t plus = validation::npos, qualStart = 0, qualLen = 0, recEnd = 0;
+            bool complete = false;
+
+            if (hdrEnd != validation::npos) {
+                // Sequence lines up to the '+' separator
+                while (p < avail && base[p] != '+') {
+                    size_t nl = findNewline(p);
+                    if (nl == validation::npos) break;
+                    seqLen += nl - p - (nl > p && base[nl - 1] == '\r');
+                    p = nl + 1;
+                }
+                if (p < avail && base[p] == '+') {
+                    plus = p;
+                    size_t nl = findNewline(plus);
+                    if (nl == validation::npos && eof) nl = avail;
+                    if (nl != validation::npos) {
+                        qualStart = p = min(nl + 1, avail);
+                        // Quality lines until they cover the sequence
+                        while (qualLen < seqLen) {
+                            size_t q = findNewline(p);
+                            if (q == validation::npos) {
+                                if (!eof) break;
+                                q = avail;
+                            }
+                            qualLen += q - p - (q > p && base[q - 1] == '\r');
+                            p = min(q + 1, avail);
+                            if (q == avail) break;
+                        }
+                        if (qualLen >= seqLen) { complete = true; recEnd = p; }
+                    }
+                }
+            }
+
+            if (!complete) {
+                bool wasEof = eof;
+                if (fill() || !wasEof) continue;    // retry once eof is known
+                throw runtime_error("SequenceReader: truncated FASTQ record");
+            }
+
+            splitHeader(rec, 1, hdrEnd);
+            size_t seqEnd = joinLines(seqStart, plus);
+            size_t qualEnd = joinLines(qualStart, recEnd);
+            rec.seq = string_view(base + seqStart, seqEnd - seqStart);
+            rec.qual = string_view(base + qualStart, qualEnd - qualStart);
+            if (rec.qual.size() != rec.seq.size())
+                throw runtime_error("SequenceReader: FASTQ quality length mismatch");
+            beg += recEnd;
+            return true;
+        }
+    }
+
+public:
+    explicit SequenceReader(const string& path, size_t chunk = size_t(1) << 20,
+                            size_t maxRecord = SIZE_MAX)
+        : buf(max(chunk, size_t(4096))), maxBuffer(maxRecord)
+    {
+#ifdef LAB5_WITH_ZLIB
+        in = (path == "-") ? gzdopen(0, "rb") : gzopen(path.c_str(), "rb");
+        if (in) gzbuffer(in, 1 << 17);
+#else
+        in = (path == "-") ? stdin : fopen(path.c_str(), "rb");
+#endif
+        if (!in) throw runtime_error("SequenceReader: cannot open " + path);
+
+#ifndef LAB5_WITH_ZLIB
+        fill();
+        if (end - beg >= 2 && uint8_t(buf[0]) == 0x1f && uint8_t(buf[1]) == 0x8b) {
+            close();
+            throw runtime_error("SequenceReader: " + path
+                                + " is gzip-compressed; build with -DLAB5_WITH_ZLIB -lz");
+        }
+#endif
+    }
+
+    SequenceReader(const SequenceReader&) = delete;
+    SequenceReader& operator=(const SequenceReader&) = delete;
+
+    ~SequenceReader() {
+        close();
+    }
+
+    void close() {
+#ifdef LAB5_WITH_ZLIB
+        if (in) gzclose(in);
+#else
+        if (in && in != stdin) fclose(in);
+#endif
+        in = nullptr;
+    }
+
+    // Reads the next record; false at end of input
+    bool next(SeqRecord& rec) {
+        for (;;) {
+            while (beg < end && (buf[beg] == '\n' || buf[beg] == '\r'))
+                ++beg;
+            if (beg < end) break;
+            if (!fill()) return false;
+        }
+
+        switch (buf[beg]) {
+            case '>': return nextFasta(rec);
+            case '@': return nextFastq(rec);
+            default:
+                throw runtime_error("SequenceReader: expected '>' or '@' at record start");
+        }
+    }
+
+    size_t bufferCapacity() const { return buf.size(); }
+};
+
+/* ============================================================
+   ReferenceStore: mmap'd FASTA with a samtools-style .fai index
+   Region lookups are an index probe plus pointer arithmetic;
+   the returned views borrow the mapping, so the store has to
+   outlive every DNASequence built from it.
+   ============================================================ */
+class ReferenceStore {
+public:
+    struct FaiEntry {
+        string name;
+        size_t length;
+        size_t offset;      // file offset of the first base
+        size_t lineBases;
+        size_t lineWidth;
+    };
+
+private:
+    int fd = -1;
+    const char* map = nullptr;
+    size_t mapSize = 0;
+    vector<FaiEntry> entries;
+    unordered_map<string, size_t> byName;
+
+    void addEntry(const FaiEntry& e) {
+        byName[e.name] = entries.size();
+        entries.push_back(e);
+    }
+
+    // Scans the mapped FASTA the way `samtools faidx` does
+    void buildIndex() {
+        size_t pos = 0;
+        while (pos < mapSize) {
+            const char* nl = static_cast<const char*>(memchr(map + pos, '\n', mapSize - pos));
+            size_t lineEnd = nl ? nl - map : mapSize;
+
+            if (map[pos] != '>') {
+                if (lineEnd > pos && !(lineEnd == pos + 1 && map[pos] == '\r'))
+                    throw runtime_error("ReferenceStore: sequence data outside a record");
+                pos = lineEnd + 1;
+                continue;
+            }
+
+            string_view header(map + pos + 1, lineEnd - pos - 1);
+            FaiEntry e{ string(header.substr(0, header.find_first_of(" \t\r"))),
+                        0, lineEnd + 1, 0, 0 };
+            pos = lineEnd + 1;
+
+            bool lastLine = false;
+            while (pos < mapSize && map[pos] != '>') {
+                nl = static_cast<const char*>(memchr(map + pos, '\n', mapSize - pos));
+                lineEnd = nl ? nl - map : mapSize;
+                size_t width = lineEnd - pos + (nl ? 1 : 0);
+                size_t bases = lineEnd - pos - (lineEnd > pos && map[lineEnd - 1] == '\r');
+
+                if (bases > 0) {
+                    if (e.lineBases == 0) {
+                        e.lineBases = bases;
+                        e.lineWidth = width;
+                    } else if (lastLine || bases > e.lineBases
+                               || (bases == e.lineBases && width != e.lineWidth)) {
+                        throw runtime_error("ReferenceStore: different line length in " + e.name);
+                    }
+                    lastLine = bases < e.lineBases;
+                    e.length += bases;
+                } else {
+                    lastLine = true;
+                }
+                pos = lineEnd + 1;
+            }
+            if (e.lineBases == 0) { e.lineBases = 1; e.lineWidth = 1; }   // empty record
+            addEntry(e);
+        }
+    }
+
+    bool readIndex(const string& faiPath) {
+        ifstream in(faiPath);
+        if (!in) return false;
+
+        string line;
+        while (getline(in, line)) {
+            if (line.empty()) continue;
+            FaiEntry e{};
+            size_t tab = line.find('\t');
+            e.name = line.substr(0, tab);
+
+            size_t* fields[4] = { &e.length, &e.offset, &e.lineBases, &e.lineWidth };
+            const char* p = line.data() + (tab == string::npos ? line.size() : tab);
+            const char* last = line.data() + line.size();
+            for (size_t* f : fields) {
+                if (p == last) throw runtime_error("ReferenceStore: malformed " + faiPath);
+                auto res = from_chars(p + 1, last, *f);
+                if (res.ec != errc()) throw runtime_error("ReferenceStore: malformed " + faiPath);
+                p = res.ptr;
+            }
+            if (e.lineBases == 0 || e.lineWidth < e.lineBases || e.offset > mapSize)
+                throw runtime_error("ReferenceStore: " + faiPath + " does not match the FASTA");
+            addEntry(e);
+        }
+        return true;
+    }
+
+public:
+    // Loads path.fai, or builds it (and tries to save it) if missing
+    explicit ReferenceStore(const string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("ReferenceStore: cannot open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); throw runtime_error("ReferenceStore: cannot stat " + path); }
+        mapSize = static_cast<size_t>(st.st_size);
+
+        if (mapSize > 0) {
+            void* m = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) { ::close(fd); throw runtime_error("ReferenceStore: cannot mmap " + path); }
+            madvise(m, mapSize, MADV_RANDOM);   // region lookups, not scans
+            map = static_cast<const char*>(m);
+        }
+
+        try {
+            if (!readIndex(path + ".fai")) {
+                buildIndex();
+                writeIndex(path + ".fai");
+            }
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    ReferenceStore(const ReferenceStore&) = delete;
+    ReferenceStore& operator=(const ReferenceStore&) = delete;
+
+    ~ReferenceStore() {
+        release();
+    }
+
+    void release() {
+        if (map) munmap(const_cast<char*>(map), mapSize);
+        if (fd >= 0) ::close(fd);
+        map = nullptr;
+        fd = -1;
+    }
+
+    // Writes the index in samtools' five-column .fai format
+    bool writeIndex(const string& faiPath) const {
+        ofstream out(faiPath);
+        for (const FaiEntry& e : entries)
+            out << e.name << '\t' << e.length << '\t' << e.offset << '\t'
+                << e.lineBases << '\t' << e.lineWidth << '\n';
+        return static_cast<bool>(out);
+    }
+
+    const vector<FaiEntry>& index() const { return entries; }
+
+    // The named entry, or nullptr
+    const FaiEntry* find(const string& name) const {
+        auto it = byName.find(name);
+        return it == byName.end() ? nullptr : &entries[it->second];
+    }
+
+    const FaiEntry& entry(const string& name) const {
+        const FaiEntry* e = find(name);
+        if (!e) throw out_of_range("ReferenceStore: unknown sequence " + name);
+        return *e;
+    }
+
+    // 0-based, half-open [start, end), clamped to the sequence
+    RefView view(const string& name, size_t start, size_t end) const {
+        const FaiEntry& e = entry(name);
+        end = min(end, e.length);
+        start = min(start, end);
+        // Byte of the last base must be inside the map (a stale .fai may say otherwise)
+        if (e.length) {
+            size_t lastLine = (e.length - 1) / e.lineBases, lastByte;
+            if (__builtin_mul_overflow(lastLine, e.lineWidth, &lastByte)
+                || __builtin_add_overflow(lastByte, e.offset + (e.length - 1) % e.lineBases, &lastByte)
+                || lastByte >= mapSize)
+                throw runtime_error("ReferenceStore: index does not match the FASTA");
+        }
+        return RefView{ map + e.offset, e.lineBases, e.lineWidth, start, end - start };
+    }
+
+    // samtools-style region: "chr17", "chr17:7668402" or "chr17:7668402-7687550"
+    // (1-based, inclusive)
+    RefView view(string_view region) const {
+        size_t colon = region.rfind(':');
+        string name(region.substr(0, colon));
+        if (colon == string_view::npos || !byName.count(name))
+            return view(string(region), 0, validation::npos);
+
+        size_t from = 1, to = validation::npos;
+        const char* p = region.data() + colon + 1;
+        const char* last = region.data() + region.size();
+        auto bad = [&region] { return invalid_argument("ReferenceStore: bad region " + string(region)); };
+        auto res = from_chars(p, last, from);
+        if (res.ec != errc()) throw bad();
+        if (res.ptr != last) {
+            if (*res.ptr != '-') throw bad();
+            res = from_chars(res.ptr + 1, last, to);
+            if (res.ec != errc() || res.ptr != last || to < from) throw bad();
+        }
+        return view(name, from ? from - 1 : 0, to);
+    }
+
+    DNASequence fetch(const string& name, size_t start, size_t end) const {
+        return DNASequence(view(name, start, end));
+    }
+
+    DNASequence fetch(string_view region) const {
+        return DNASequence(view(region));
+    }
+};
+
+/* ============================================================
+   Symbol / SymbolTable: interned identifiers
+   Chromosome names, gene and isoform ids and names are stored
+   once in a process-wide table and carried around as 32-bit
+   handles, so copies, equality and hashing are integer work.
+   Interning locks one of 16 shards (shared for hits, exclusive
+   for new strings); resolving a handle is lock-free: entries
+   live in fixed chunks that are never moved.
+   ============================================================ */
+class Symbol {
+private:
+    uint32_t handle = 0;        // 0 is the empty string
+
+public:
+    Symbol() = default;
+    explicit Symbol(uint32_t h) : handle(h) {}
+
+    uint32_t id() const { return handle; }
+    bool empty() const { return handle == 0; }
+
+    bool operator==(Symbol o) const { return handle == o.handle; }
+    bool operator!=(Symbol o) const { return handle != o.handle; }
+    bool operator<(Symbol o) const { return handle < o.handle; }     // interning order, not alphabetical
+
+    inline const string& str() const;
+};
+
+namespace std {
+template <>
+struct hash<Symbol> {
+    size_t operator()(Symbol s) const noexcept { return s.id(); }
+};
+}  // namespace std
+
+class SymbolTable {
+private:
+    static constexpr size_t CHUNK_BITS = 16;
+    static constexpr size_t CHUNK = size_t(1) << CHUNK_BITS;
+    static constexpr size_t MAX_CHUNKS = size_t(1) << 16;    // 2^32 symbols
+    static constexpr size_t SHARDS = 16;
+
+    struct Shard {
+        shared_mutex lock;
+        unordered_map<string_view, uint32_t> ids;
+        deque<string> strings;      // deque: elements never move
+    };
+
+    Shard shards[SHARDS];
+    atomic<atomic<const string*>*> chunks[MAX_CHUNKS] = {};   // owned; the table is never freed
+    mutex chunkLock;
+    atomic<uint32_t> next{ 1 };
+    const string emptyString;
+
+    atomic<const string*>* chunkFor(uint32_t id) {
+        atomic<atomic<const string*>*>& slot = chunks[id >> CHUNK_BITS];
+        atomic<const string*>* p = slot.load(memory_order_acquire);
+        if (p) return p;
+        lock_guard<mutex> g(chunkLock);
+        p = slot.load(memory_order_relaxed);
+        if (!p) {
+            p = new atomic<const string*>[CHUNK];
+            slot.store(p, memory_order_release);
+        }
+        return p;
+    }
+
+    SymbolTable() = default;
+
+public:
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    // Never destroyed, so symbols stay valid during static destruction
+    static SymbolTable& global() {
+        static SymbolTable* table = new SymbolTable();
+        return *table;
+    }
+
+    Symbol intern(string_view s) {
+        if (s.empty()) return Symbol();
+        Shard& sh = shards[std::hash<string_view>()(s) % SHARDS];
+        {
+            shared_lock<shared_mutex> g(sh.lock);
+            auto it = sh.ids.find(s);
+            if (it != sh.ids.end()) return Symbol(it->second);
+        }
+        unique_lock<shared_mutex> g(sh.lock);
+        auto it = sh.ids.find(s);
+        if (it != sh.ids.end()) return Symbol(it->second);
+
+        uint32_t id = next.fetch_add(1, memory_order_relaxed);
+        if (id == 0) throw length_error("SymbolTable: out of handles");
+        const string& stored = sh.strings.emplace_back(s);
+        chunkFor(id)[id & (CHUNK - 1)].store(&stored, memory_order_release);
+        sh.ids.emplace(string_view(stored), id);
+        return Symbol(id);
+    }
+
+    // Symbol of s if it was interned before, else the empty Symbol
+    Symbol find(string_view s) {
+        if (s.empty()) return Symbol();
+        Shard& sh = shards[std::hash<string_view>()(s) % SHARDS];
+        shared_lock<shared_mutex> g(sh.lock);
+        auto it = sh.ids.find(s);
+        return it == sh.ids.end() ? Symbol() : Symbol(it->second);
+    }
+
+    const string& str(Symbol s) const {
+        if (s.empty()) return emptyString;
+        atomic<const string*>* chunk = chunks[s.id() >> CHUNK_BITS].load(memory_order_acquire);
+        return *chunk[s.id() & (CHUNK - 1)].load(memory_order_acquire);
+    }
+
+    size_t size() const { return next.load(memory_order_relaxed) - 1; }
+};
+
+inline const string& Symbol::str() const { return SymbolTable::global().str(*this); }
+
+inline Symbol intern(string_view s) { return SymbolTable::global().intern(s); }
+
+/* ============================================================
+   Isoform: contains RNASequence (composition + derived class)
+   ============================================================ */
+class Isoform {
+public:
+    // Allocator-aware, so a pmr::vector<Isoform> built on an arena
+    // puts each isoform's sequence in the same arena
+    using allocator_type = SeqAllocator;
+
+    // Exon in pre-mRNA coordinates: 0-based, 5'->3' on the gene's strand
+    struct Exon { uint32_t start; uint32_t len; };
+
+private:
+    Symbol id;
+    Symbol name;
+    RNASequence rna;        // own bases; empty while spliced
+
+    /* Spliced form: exons over the gene's shared pre-mRNA. Copies
+       share all three pointers; the joined sequence is built on the
+       first sequence() call, and mutableSequence() detaches. */
+    shared_ptr<const RNASequence> backing;
+    shared_ptr<const vector<Exon>> exons;
+    mutable shared_ptr<const RNASequence> joined;
+    size_t splicedLength = 0;
+
+    const RNASequence& materialize() const {
+        shared_ptr<const RNASequence> cur = atomic_load(&joined);
+        if (cur) return *cur;
+        string text;
+        text.reserve(splicedLength);
+        for (const Exon& e : *exons) text += backing->substr(e.start, e.len);
+        auto built = make_shared<const RNASequence>(text, rna.packed().get_allocator());
+        // Another thread may have won the race; either copy is fine
+        if (atomic_compare_exchange_strong(&joined, &cur, built)) return *built;
+        return *cur;
+    }
+
+public:
+    Isoform(string_view i, string_view n, string_view seq, const allocator_type& a = {})
+        : Isoform(intern(i), intern(n), seq, a) {}
+
+    Isoform(Symbol i, Symbol n, string_view seq, const allocator_type& a = {})
+        : id(i), name(n), rna(seq, a)
+    {
+        LifecycleTrace::record("Isoform", LifeEvent::Created, this, &name.str());
+    }
+
+    // Adopts an already built sequence (e.g. SeqRecord::toRNA())
+    Isoform(string_view i, string_view n, RNASequence&& seq, const allocator_type& a = {})
+        : Isoform(intern(i), intern(n), move(seq), a) {}
+
+    Isoform(Symbol i, Symbol n, RNASequence&& seq, const allocator_type& a = {})
+        : id(i), name(n), rna(move(seq), a)
+    {
+        LifecycleTrace::record("Isoform", LifeEvent::Created, this, &name.str());
+    }
+
+    // Spliced from a shared pre-mRNA: O(exons), no bases are copied
+    Isoform(Symbol i, Symbol n, shared_ptr<const RNASequence> preMRNA, vector<Exon> exonList,
+            const allocator_type& a = {})
+        : id(i), name(n), rna(string_view(), a), backing(move(preMRNA))
+    {
+        if (!backing) throw invalid_argument("Isoform: no pre-mRNA to splice");
+        for (const Exon& e : exonList) {
+            if (size_t(e.start) + e.len > backing->length())
+                throw out_of_range("Isoform: exon outside the pre-mRNA");
+            splicedLength += e.len;
+        }
+        exons = make_shared<const vector<Exon>>(move(exonList));
+        LifecycleTrace::record("Isoform", LifeEvent::Created, this, &name.str());
+    }
+
+    Isoform(string_view i, string_view n, shared_ptr<const RNASequence> preMRNA,
+            vector<Exon> exonList, const allocator_type& a = {})
+        : Isoform(intern(i), intern(n), move(preMRNA), move(exonList), a) {}
+
+    // Copies read joined atomically: a const sequence() call on o may be filling it
+    Isoform(const Isoform& o)
+        : id(o.id), name(o.name), rna(o.rna), backing(o.backing), exons(o.exons),
+          joined(atomic_load(&o.joined)), splicedLength(o.splicedLength) {}
+    Isoform(Isoform&&) noexcept = default;
+
+    Isoform& operator=(const Isoform& o) {
+        if (this == &o) return *this;
+        id = o.id;
+        name = o.name;
+        rna = o.rna;
+        backing = o.backing;
+        exons = o.exons;
+        joined = atomic_load(&o.joined);
+        splicedLength = o.splicedLength;
+        return *this;
+    }
+    Isoform& operator=(Isoform&&) = default;
+
+    Isoform(const Isoform& o, const allocator_type& a)
+        : id(o.id), name(o.name), rna(o.rna, a), backing(o.backing), exons(o.exons),
+          joined(atomic_load(&o.joined)), splicedLength(o.splicedLength) {}
+    Isoform(Isoform&& o, const allocator_type& a)
+        : id(o.id), name(o.name), rna(move(o.rna), a), backing(move(o.backing)),
+          exons(move(o.exons)), joined(move(o.joined)), splicedLength(o.splicedLength) {}
+
+    ~Isoform() {
+        LifecycleTrace::record("Isoform", LifeEvent::Destroyed, this, &name.str());
+    }
+
+    const string& getId() const { return id.str(); }
+    const string& getName() const { return name.str(); }
+    Symbol idSymbol() const { return id; }
+    Symbol nameSymbol() const { return name; }
+
+    bool isSpliced() const { return backing != nullptr; }
+    size_t length() const { return backing ? splicedLength : rna.length(); }
+    const shared_ptr<const RNASequence>& preMRNA() const { return backing; }
+    const vector<Exon>& exonList() const {
+        static const vector<Exon> none;
+        return exons ? *exons : none;
+    }
+
+    // The transcript; a spliced isoform joins its exons on first use
+    const RNASequence& sequence() const { return backing ? materialize() : rna; }
+
+    // Copy-on-write: a spliced isoform takes its own copy of the bases
+    // first, so the shared pre-mRNA and other copies never change
+    RNASequence& mutableSequence() {
+        if (backing) {
+            rna = RNASequence(materialize(), rna.packed().get_allocator());
+            backing.reset();
+            exons.reset();
+            joined.reset();
+            splicedLength = 0;
+        }
+        return rna;
+    }
+
+    // Bases [pos, pos+len) of the transcript, read through the exons when spliced
+    void writeBases(OutputSink& out, size_t pos = 0, size_t len = SIZE_MAX) const {
+        if (!backing) {
+            rna.writeBases(out, pos, len);
+            return;
+        }
+        len = min(len, splicedLength - min(pos, splicedLength));
+        for (const Exon& e : *exons) {
+            if (len == 0) break;
+            if (pos >= e.len) { pos -= e.len; continue; }
+            size_t take = min<size_t>(len, e.len - pos);
+            backing->writeBases(out, e.start + pos, take);
+            len -= take;
+            pos = 0;
+        }
+    }
+
+    // Heap bytes this isoform keeps alive (the shared pre-mRNA excluded)
+    size_t memoryUsage() const {
+        if (!backing) return rna.packed().memoryUsage();
+        size_t bytes = sizeof(vector<Exon>) + exons->capacity() * sizeof(Exon);
+        if (auto cached = atomic_load(&joined)) bytes += cached->packed().memoryUsage();
+        return bytes;
+    }
+
+    void describe(OutputSink& out) const {
+        out << "Isoform " << id.str() << " (" << name.str() << ")\n";
+        if (backing) {
+            out << "RNA sequence: ";
+            writeBases(out);
+            out << '\n';
+        } else {
+            rna.describe(out);
+        }
+        out << "Length: " << length() << " bases\n";
+    }
+
+    void describe() const {
+        StreamSink out(cout);
+        describe(out);
+    }
+};
+
+// vector<Isoform> only moves on growth if the move cannot throw
+static_assert(is_nothrow_move_constructible<Isoform>::value,
+              "Isoform must be nothrow-movable");
+
+/* ============================================================
+   Gene: contains multiple Isoforms
+   ============================================================ */
+class Gene {
+public:
+    using allocator_type = SeqAllocator;
+
+private:
+    Symbol id;
+    Symbol name;
+    Symbol chrom;
+    int start;
+    int end;
+    char strand;
+
+    pmr::vector<Isoform> isoforms;
+    shared_ptr<const RNASequence> pre;      // pre-mRNA shared by spliced isoforms
+
+public:
+    Gene(string_view i, string_view n,
+         string_view c, int s, int e, char st, const allocator_type& a = {})
+        : Gene(intern(i), intern(n), intern(c), s, e, st, a) {}
+
+    Gene(Symbol i, Symbol n, Symbol c, int s, int e, char st, const allocator_type& a = {})
+        : id(i), name(n), chrom(c), start(s), end(e), strand(st), isoforms(a)
+    {
+        LifecycleTrace::record("Gene", LifeEvent::Created, this, &name.str());
+    }
+
+    Gene(const Gene&) = default;
+    Gene(Gene&&) noexcept = default;
+    Gene& operator=(const Gene&) = default;
+    Gene& operator=(Gene&&) = default;
+
+    Gene(const Gene& o, const allocator_type& a)
+        : id(o.id), name(o.name), chrom(o.chrom), start(o.start), end(o.end),
+          strand(o.strand), isoforms(o.isoforms, a), pre(o.pre) {}
+    Gene(Gene&& o, const allocator_type& a)
+        : id(o.id), name(o.name), chrom(o.chrom), start(o.start),
+          end(o.end), strand(o.strand), isoforms(move(o.isoforms), a), pre(move(o.pre)) {}
+
+    ~Gene() {
+        LifecycleTrace::record("Gene", LifeEvent::Destroyed, this, &name.str());
+    }
+
+    void addIsoform(const Isoform& iso) {
+        isoforms.push_back(iso);
+    }
+
+    void addIsoform(Isoform&& iso) {
+        isoforms.push_back(move(iso));
+    }
+
+    // Builds the isoform in place from Isoform constructor arguments
+    template <typename... Args>
+    Isoform& emplaceIsoform(Args&&... args) {
+        return isoforms.emplace_back(forward<Args>(args)...);
+    }
+
+    void reserveIsoforms(size_t n) {
+        isoforms.reserve(n);
+    }
+
+    size_t isoformCount() const { return isoforms.size(); }
+    const pmr::vector<Isoform>& getIsoforms() const { return isoforms; }
+
+    // The unspliced transcript of the whole gene span (5'->3' on the strand)
+    void setPreMRNA(RNASequence seq) {
+        if (seq.length() != size_t(end - start + 1))
+            throw invalid_argument("Gene: pre-mRNA length does not match the gene span");
+        pre = make_shared<const RNASequence>(move(seq));
+    }
+
+    void loadPreMRNA(const ReferenceStore& ref) {
+        setPreMRNA(codingStrand(ref).transcribe());
+    }
+
+    const shared_ptr<const RNASequence>& preMRNA() const { return pre; }
+
+    /* Isoform spliced from exons given like the gene's own coordinates
+       (1-based, inclusive, forward strand, any order). Only the exon
+       list is stored; the bases stay in the shared pre-mRNA. */
+    Isoform& addSplicedIsoform(string_view isoId, string_view isoName,
+                               vector<pair<int, int>> genomicExons) {
+        if (!pre) throw logic_error("Gene: no pre-mRNA to splice; call setPreMRNA first");
+        sort(genomicExons.begin(), genomicExons.end());
+        if (strand == '-') reverse(genomicExons.begin(), genomicExons.end());
+
+        vector<Isoform::Exon> exons;
+        exons.reserve(genomicExons.size());
+        for (auto [s, e] : genomicExons) {
+            if (s > e || s < start || e > end)
+                throw out_of_range("Gene: exon outside the gene span");
+            uint32_t offset = strand == '-' ? uint32_t(end - e) : uint32_t(s - start);
+            exons.push_back({offset, uint32_t(e - s + 1)});
+        }
+        return isoforms.emplace_back(intern(isoId), intern(isoName), pre, move(exons));
+    }
+
+    // Heap bytes held by the isoforms plus the shared pre-mRNA (counted once)
+    size_t memoryUsage() const {
+        size_t bytes = isoforms.capacity() * sizeof(Isoform);
+        for (const Isoform& iso : isoforms) bytes += iso.memoryUsage();
+        if (pre) bytes += pre->packed().memoryUsage();
+        return bytes;
+    }
+
+    // Forward-strand bases of chrom:start-end, borrowed from the reference
+    DNASequence genomicSequence(const ReferenceStore& ref) const {
+        return ref.fetch(chrom.str(), start - 1, end);
+    }
+
+    // The gene's span read 5'->3' on its own strand
+    DNASequence codingStrand(const ReferenceStore& ref) const {
+        DNASequence span = genomicSequence(ref);
+        if (strand == '-') span.reverseComplementInPlace();
+        return span;
+    }
+
+    const string& getId() const { return id.str(); }
+    const string& getName() const { return name.str(); }
+    const string& getChrom() const { return chrom.str(); }
+    Symbol idSymbol() const { return id; }
+    Symbol nameSymbol() const { return name; }
+    Symbol chromSymbol() const { return chrom; }
+    int getStart() const { return start; }
+    int getEnd() const { return end; }
+    char getStrand() const { return strand; }
+
+    void describe(OutputSink& out) const {
+        out << "Gene " << id.str() << " (" << name.str() << ") on "
+            << chrom.str() << ':' << start << '-' << end
+            << " (" << strand << " strand)\n";
+
+        out << "Isoforms:\n";
+        for (const auto& iso : isoforms)
+            iso.describe(out);
+    }
+
+    void describe() const {
+        StreamSink out(cout);
+        describe(out);
+    }
+};
+
+/* ============================================================
+   SequenceArena: bulk allocation for a batch of objects
+   Objects built with make<T>() live in one monotonic buffer and
+   get the arena as their allocator, so sequence buffers and
+   isoform vectors land next to them. clear() (or the arena's
+   destructor) drops the whole batch at once. Protein sequences are
+   not even visited when tracing is off: all their memory is in the
+   arena. Other types are destroyed newest first because they own
+   heap memory: nucleotide sequences their cache and FM-index,
+   genes their shared pre-mRNA, and spliced isoforms the shared
+   pre-mRNA, their exon vector and the cached joined sequence.
+   ============================================================ */
+class SequenceArena {
+private:
+    struct Cleanup {
+        void (*destroy)(void*);
+        void* object;
+        Cleanup* next;
+    };
+
+    pmr::monotonic_buffer_resource pool;
+    Cleanup* cleanups = nullptr;
+    size_t objects = 0;
+
+    template <typename T>
+    static constexpr bool skipsDestructor() {
+        return is_base_of<Sequence, T>::value && !is_base_of<NucleotideSequence, T>::value
+            && is_same<LifecycleTrace, NoTrace>::value;
+    }
+
+public:
+    explicit SequenceArena(size_t initialBytes = size_t(1) << 20)
+        : pool(initialBytes) {}
+
+    SequenceArena(const SequenceArena&) = delete;
+    SequenceArena& operator=(const SequenceArena&) = delete;
+
+    ~SequenceArena() {
+        clear();
+    }
+
+    pmr::memory_resource* resource() { return &pool; }
+    SeqAllocator allocator() { return SeqAllocator(&pool); }
+    size_t size() const { return objects; }
+
+    // Constructs T(args..., allocator) inside the arena
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        void* mem = pool.allocate(sizeof(T), alignof(T));
+        T* obj = new (mem) T(forward<Args>(args)..., allocator());
+
+        if constexpr (!skipsDestructor<T>()) {
+            void* node = pool.allocate(sizeof(Cleanup), alignof(Cleanup));
+            cleanups = new (node) Cleanup{ [](void* p) { static_cast<T*>(p)->~T(); },
+                                           obj, cleanups };
+        }
+        ++objects;
+        return obj;
+    }
+
+    // Ends the lifetime of everything made so far and frees it in one go
+    void clear() {
+        for (Cleanup* c = cleanups; c; c = c->next)
+            c->destroy(c->object);
+        cleanups = nullptr;
+        objects = 0;
+        pool.release();
+    }
+};
+
+/* ============================================================
+   ThreadPool: work-stealing pool
+   Each worker owns a deque: it pushes and pops at the back and
+   idle workers steal from the front of the others. Threads that
+   wait for a parallelFor() run queued tasks meanwhile, so nested
+   parallel loops cannot deadlock.
+   ============================================================ */
+class ThreadPool {
+private:
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    atomic<size_t> queued{ 0 };
+    atomic<size_t> nextQueue{ 0 };
+    atomic<bool> stopping{ false };
+    mutex sleepLock;
+    condition_variable wake;
+
+    static int& currentWorker() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    bool popLocal(size_t w, function<void()>& task) {
+        lock_guard<mutex> guard(workers[w]->lock);
+        if (workers[w]->tasks.empty()) return false;
+        task = move(workers[w]->tasks.back());
+        workers[w]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t from, function<void()>& task) {
+        size_t n = workers.size();
+        for (size_t k = 0; k < n; ++k) {
+            Worker& v = *workers[(from + k) % n];
+            lock_guard<mutex> guard(v.lock);
+            if (v.tasks.empty()) continue;
+            task = move(v.tasks.front());
+            v.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    // Runs one queued task if there is any
+    bool runOne() {
+        function<void()> task;
+        int self = currentWorker();
+        bool got = (self >= 0 && popLocal(size_t(self), task))
+                || steal(self >= 0 ? size_t(self) + 1 : 0, task);
+        if (!got) return false;
+        queued.fetch_sub(1, memory_order_relaxed);
+        task();
+        return true;
+    }
+
+    void workerLoop(int index) {
+        currentWorker() = index;
+        while (!stopping.load(memory_order_acquire)) {
+            if (runOne()) continue;
+            unique_lock<mutex> guard(sleepLock);
+            wake.wait(guard, [this] {
+                return stopping.load(memory_order_acquire) || queued.load(memory_order_acquire) > 0;
+            });
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t n = thread::hardware_concurrency()) {
+        n = max<size_t>(n, 1);
+        for (size_t i = 0; i < n; ++i)
+            workers.push_back(make_unique<Worker>());
+        for (size_t i = 0; i < n; ++i)
+            threads.emplace_back([this, i] { workerLoop(int(i)); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping.store(true, memory_order_release);
+        }
+        wake.notify_all();
+        for (thread& t : threads) t.join();
+    }
+
+    size_t size() const { return threads.size(); }
+
+    // Process-wide pool sized to the machine
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void submit(function<void()> task) {
+        int self = currentWorker();
+        size_t w = self >= 0 ? size_t(self)
+                             : nextQueue.fetch_add(1, memory_order_relaxed) % workers.size();
+        {
+            lock_guard<mutex> guard(workers[w]->lock);
+            workers[w]->tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> guard(sleepLock);
+            queued.fetch_add(1, memory_order_release);
+        }
+        wake.notify_one();
+    }
+
+    /* Calls f(begin, end) over [0, n) in chunks of about `grain`
+       items and returns once every chunk is done. If a chunk throws,
+       the chunks not yet started are skipped, the rest are waited for
+       (they still refer to f) and the first exception is rethrown
+       here. */
+    template <typename F>
+    void parallelFor(size_t n, size_t grain, F f) {
+        if (n == 0) return;
+        grain = max<size_t>(grain, 1);
+        size_t chunks = (n + grain - 1) / grain;
+        if (chunks == 1) { f(size_t(0), n); return; }
+
+        atomic<size_t> left{ chunks };
+        atomic<bool> failed{ false };
+        exception_ptr error;
+        auto run = [&f, &left, &failed, &error](size_t b, size_t e) {
+            if (!failed.load(memory_order_relaxed)) {
+                try {
+                    f(b, e);
+                } catch (...) {
+                    if (!failed.exchange(true, memory_order_acq_rel)) error = current_exception();
+                }
+            }
+            left.fetch_sub(1, memory_order_acq_rel);
+        };
+
+        for (size_t c = 1; c < chunks; ++c) {
+            size_t b = c * grain, e = min(n, b + grain);
+            submit([&run, b, e] { run(b, e); });
+        }
+        run(size_t(0), min(n, grain));
+
+        while (left.load(memory_order_acquire) > 0)
+            if (!runOne()) this_thread::yield();
+        if (error) rethrow_exception(error);
+    }
+};
+
+/* ============================================================
+   BatchEngine: parallel validation and classification
+   Items are bucketed by concrete type first, so every chunk
+   runs one statically dispatched kernel over a single type.
+   Results come back as a flat array in input order.
+   ============================================================ */
+class BatchEngine {
+public:
+    struct Result {
+        uint64_t length;
+        uint64_t firstInvalid;      // validation::npos if valid
+        // DNA/RNA: A, C, G, T/U (any case)
+        // Protein: hydrophobic, polar, positive, negative residues
+        uint64_t composition[4];
+        SequenceKind kind;
+    };
+
+    struct Summary {
+        size_t count[3] = {};       // indexed by SequenceKind
+        size_t valid[3] = {};
+        uint64_t residues[3] = {};
+        uint64_t shortest = 0;
+        uint64_t longest = 0;
+    };
+
+private:
+    // 0 hydrophobic, 1 polar, 2 positive, 3 negative, 4 other
+    static const array<uint8_t, 256>& residueClass() {
+        static const array<uint8_t, 256> table = [] {
+            array<uint8_t, 256> t;
+            t.fill(4);
+            const char* groups[4] = { "AVILMFWC", "STNQYGP", "KRH", "DE" };
+            for (uint8_t g = 0; g < 4; ++g)
+                for (const char* p = groups[g]; *p; ++p) {
+                    t[static_cast<unsigned char>(*p)] = g;
+                    t[static_cast<unsigned char>(*p - 'A' + 'a')] = g;
+                }
+            return t;
+        }();
+        return table;
+    }
+
+    template <typename Seq>
+    static void nucleotideKernel(const Seq& s, Result& r) {
+        r.length = s.Seq::length();
+        r.firstInvalid = s.Seq::firstInvalid();
+        array<uint64_t, 4> counts = s.countBases();
+        copy(counts.begin(), counts.end(), r.composition);
+    }
+
+    static void proteinKernel(const ProteinSequence& s, Result& r) {
+        string_view res = s.residues();
+        r.length = res.size();
+        r.firstInvalid = s.ProteinSequence::firstInvalid();
+        uint64_t counts[5] = {};
+        const array<uint8_t, 256>& cls = residueClass();
+        for (char c : res) ++counts[cls[static_cast<unsigned char>(c)]];
+        copy(counts, counts + 4, r.composition);
+    }
+
+public:
+    static vector<Result> run(const vector<Sequence*>& seqs,
+                              ThreadPool& pool = ThreadPool::shared(),
+                              size_t grain = 256) {
+        vector<Result> results(seqs.size());
+
+        // Bucket indices by type (one virtual call per item)
+        vector<uint32_t> byKind[3];
+        for (size_t i = 0; i < seqs.size(); ++i)
+            byKind[size_t(seqs[i]->kind())].push_back(uint32_t(i));
+
+        for (size_t k = 0; k < 3; ++k) {
+            const vector<uint32_t>& idx = byKind[k];
+            SequenceKind kind = SequenceKind(k);
+            pool.parallelFor(idx.size(), grain, [&](size_t b, size_t e) {
+                for (size_t j = b; j < e; ++j) {
+                    Result& r = results[idx[j]];
+                    r.kind = kind;
+                    const Sequence* s = seqs[idx[j]];
+                    switch (kind) {
+                        case SequenceKind::DNA:
+                            nucleotideKernel(*static_cast<const DNASequence*>(s), r);
+                            break;
+                        case SequenceKind::RNA:
+                            nucleotideKernel(*static_cast<const RNASequence*>(s), r);
+                            break;
+                        case SequenceKind::Protein:
+                            proteinKernel(*static_cast<const ProteinSequence*>(s), r);
+                            break;
+                    }
+                }
+            });
+        }
+        return results;
+    }
+
+    static Summary summarize(const vector<Result>& results) {
+        Summary s;
+        if (!results.empty()) s.shortest = results[0].length;
+        for (const Result& r : results) {
+            size_t k = size_t(r.kind);
+            ++s.count[k];
+            s.valid[k] += (r.firstInvalid == validation::npos);
+            s.residues[k] += r.length;
+            s.shortest = min(s.shortest, r.length);
+            s.longest = max(s.longest, r.length);
+        }
+        return s;
+    }
+};
+
+/* ============================================================
+   GeneAnnotation: a collection of Genes with an overlap index
+   Each chromosome's genes are kept sorted by start in one array
+   laid out as an implicit augmented interval tree (cgranges
+   style): node i at level k has children i -/+ 2^(k-1), and
+   maxEnd holds the largest end in its subtree. Coordinates are
+   1-based and inclusive, like Gene's.
+   ============================================================ */
+class GeneAnnotation {
+private:
+    struct Node {
+        int32_t start;      // 0-based, half-open [start, end)
+        int32_t end;
+        int32_t maxEnd;
+        uint32_t gene;      // index into genes
+        char strand;
+    };
+
+    struct Chrom {
+        size_t off = 0;
+        size_t n = 0;
+        int rootLevel = -1;
+    };
+
+    vector<Gene> genes;
+    vector<Node> nodes;
+    vector<Chrom> chroms;
+    unordered_map<Symbol, int> chromIds;
+    bool indexed = false;
+
+    static bool strandMatches(char want, char s) {
+        return want == 0 || want == '.' || want == s;
+    }
+
+    // Fills maxEnd bottom-up; returns the root level
+    static int indexChrom(Node* a, size_t n) {
+        if (n == 0) return -1;
+        size_t lastI = 0;
+        int32_t last = 0;
+        for (size_t i = 0; i < n; i += 2) {
+            lastI = i;
+            last = a[i].maxEnd = a[i].end;
+        }
+        int k = 1;
+        for (; (size_t(1) << k) <= n; ++k) {
+            size_t x = size_t(1) << (k - 1), i0 = (x << 1) - 1, step = x << 2;
+            for (size_t i = i0; i < n; i += step) {
+                int32_t el = a[i - x].maxEnd;
+                int32_t er = (i + x < n) ? a[i + x].maxEnd : last;
+                a[i].maxEnd = max(a[i].end, max(el, er));
+            }
+            lastI = (lastI >> k & 1) ? lastI - x : lastI + x;
+            if (lastI < n && a[lastI].maxEnd > last)
+                last = a[lastI].maxEnd;
+        }
+        return k - 1;
+    }
+
+    // Calls f(gene index) for each node overlapping [st, en), in start order
+    template <typename F>
+    void query(const Chrom& c, int32_t st, int32_t en, char want, F f) const {
+        if (c.n == 0) return;
+        const Node* r = nodes.data() + c.off;
+        struct Frame { size_t x; int k; bool leftDone; };
+        Frame stack[64];
+        int t = 0;
+        stack[t++] = { (size_t(1) << c.rootLevel) - 1, c.rootLevel, false };
+
+        while (t) {
+            Frame z = stack[--t];
+            if (z.k <= 3) {
+                // Small subtree: linear scan of its contiguous range
+                size_t i0 = z.x >> z.k << z.k;
+                size_t i1 = min(i0 + (size_t(1) << (z.k + 1)) - 1, c.n);
+                for (size_t i = i0; i < i1 && r[i].start < en; ++i)
+                    if (st < r[i].end && strandMatches(want, r[i].strand))
+                        f(r[i].gene);
+            } else if (!z.leftDone) {
+                size_t y = z.x - (size_t(1) << (z.k - 1));
+                stack[t++] = { z.x, z.k, true };
+                if (y >= c.n || r[y].maxEnd > st)
+                    stack[t++] = { y, z.k - 1, false };
+            } else if (z.x < c.n && r[z.x].start < en) {
+                if (st < r[z.x].end && strandMatches(want, r[z.x].strand))
+                    f(r[z.x].gene);
+                stack[t++] = { z.x + (size_t(1) << (z.k - 1)), z.k - 1, false };
+            }
+        }
+    }
+
+public:
+    GeneAnnotation() = default;
+
+    // Takes over a whole batch of genes (e.g. from AnnotationReader)
+    explicit GeneAnnotation(vector<Gene> batch) : genes(move(batch)) {}
+
+    void add(const Gene& g) {
+        genes.push_back(g);
+        indexed = false;
+    }
+
+    void add(Gene&& g) {
+        genes.push_back(move(g));
+        indexed = false;
+    }
+
+    template <typename... Args>
+    Gene& emplace(Args&&... args) {
+        indexed = false;
+        return genes.emplace_back(forward<Args>(args)...);
+    }
+
+    void reserve(size_t n) { genes.reserve(n); }
+
+    size_t size() const { return genes.size(); }
+    const Gene& operator[](size_t i) const { return genes[i]; }
+    const vector<Gene>& all() const { return genes; }
+
+    // Sorts every chromosome's intervals and builds the implicit trees
+    void build() {
+        chromIds.clear();
+        chroms.clear();
+        vector<int> geneChrom(genes.size());
+        for (size_t i = 0; i < genes.size(); ++i) {
+            auto ins = chromIds.emplace(genes[i].chromSymbol(), int(chroms.size()));
+            if (ins.second) chroms.emplace_back();
+            geneChrom[i] = ins.first->second;
+            ++chroms[geneChrom[i]].n;
+        }
+        for (size_t c = 1; c < chroms.size(); ++c)
+            chroms[c].off = chroms[c - 1].off + chroms[c - 1].n;
+
+        nodes.assign(genes.size(), Node{});
+        vector<size_t> fillPos(chroms.size());
+        for (size_t c = 0; c < chroms.size(); ++c) fillPos[c] = chroms[c].off;
+        for (size_t i = 0; i < genes.size(); ++i) {
+            const Gene& g = genes[i];
+            nodes[fillPos[geneChrom[i]]++] = Node{ g.getStart() - 1, g.getEnd(), 0,
+                                                    uint32_t(i), g.getStrand() };
+        }
+
+        for (Chrom& c : chroms) {
+            Node* a = nodes.data() + c.off;
+            sort(a, a + c.n, [](const Node& x, const Node& y) {
+                return x.start != y.start ? x.start < y.start : x.end < y.end;
+            });
+            c.rootLevel = indexChrom(a, c.n);
+        }
+        indexed = true;
+    }
+
+    // -1 if no gene lies on that chromosome
+    int chromId(Symbol chrom) const {
+        auto it = chromIds.find(chrom);
+        return it == chromIds.end() ? -1 : it->second;
+    }
+
+    int chromId(const string& chrom) const {
+        Symbol s = SymbolTable::global().find(chrom);
+        return s.empty() ? -1 : chromId(s);
+    }
+
+    // Calls f(const Gene&) for each gene overlapping [from, to]
+    template <typename F>
+    void forEachOverlap(int chrom, int from, int to, char strand, F f) const {
+        if (!indexed) throw logic_error("GeneAnnotation: build() not called");
+        if (chrom < 0 || from > to) return;
+        query(chroms[chrom], from - 1, to, strand,
+              [&](uint32_t gi) { f(genes[gi]); });
+    }
+
+    vector<const Gene*> overlaps(const string& chrom, int from, int to, char strand = 0) const {
+        vector<const Gene*> out;
+        forEachOverlap(chromId(chrom), from, to, strand,
+                       [&out](const Gene& g) { out.push_back(&g); });
+        return out;
+    }
+
+    vector<const Gene*> overlaps(const string& chrom, int pos, char strand = 0) const {
+        return overlaps(chrom, pos, pos, strand);
+    }
+
+    /* Batch query for ranges sorted by start (e.g. positions of a
+       sorted VCF or BAM): one sweep over the chromosome with an
+       active list, instead of a tree walk per query. Calls
+       f(query index, const Gene&). Unsorted input falls back to
+       per-query lookups. */
+    template <typename F>
+    void forEachOverlapSorted(int chrom, const vector<pair<int, int>>& ranges,
+                              char strand, F f) const {
+        if (!indexed) throw logic_error("GeneAnnotation: build() not called");
+        if (chrom < 0) return;
+
+        if (!is_sorted(ranges.begin(), ranges.end(),
+                       [](const pair<int, int>& a, const pair<int, int>& b) {
+                           return a.first < b.first;
+                       })) {
+            for (size_t q = 0; q < ranges.size(); ++q)
+                forEachOverlap(chrom, ranges[q].first, ranges[q].second, strand,
+                               [&](const Gene& g) { f(q, g); });
+            return;
+        }
+
+        const Chrom& c = chroms[chrom];
+        const Node* r = nodes.data() + c.off;
+        vector<const Node*> active;
+        size_t next = 0;
+
+        for (size_t q = 0; q < ranges.size(); ++q) {
+            int32_t st = ranges[q].first - 1, en = ranges[q].second;
+            while (next < c.n && r[next].start < en) {
+                if (strandMatches(strand, r[next].strand))
+                    active.push_back(r + next);
+                ++next;
+            }
+            // Drop intervals that end before this (and so every later) query
+            active.erase(remove_if(active.begin(), active.end(),
+                                   [st](const Node* a) { return a->end <= st; }),
+                         active.end());
+            for (const Node* a : active)
+                if (a->start < en)
+                    f(q, genes[a->gene]);
+        }
+    }
+};
+
+/* ============================================================
+   emit: FASTA, BED and GTF records written into an OutputSink.
+   Gene coordinates are 1-based and inclusive, which GTF keeps;
+   BED is written 0-based, half-open.
+   ============================================================ */
+namespace emit {
+
+// Residues wrapped at width per line (0 = one line)
+inline void fastaBody(OutputSink& out, const Sequence& seq, size_t width = 60) {
+    size_t n = seq.length();
+    if (width == 0) width = max<size_t>(n, 1);
+    const NucleotideSequence* nt = seq.kind() == SequenceKind::Protein
+        ? nullptr : static_cast<const NucleotideSequence*>(&seq);
+    for (size_t pos = 0; pos < n; pos += width) {
+        size_t len = min(width, n - pos);
+        if (nt) nt->writeBases(out, pos, len);
+        else out.write(static_cast<const ProteinSequence&>(seq).residues().substr(pos, len));
+        out.put('\n');
+    }
+}
+
+// Same, read through a spliced isoform's exons without joining them
+inline void fastaBody(OutputSink& out, const Isoform& iso, size_t width = 60) {
+    size_t n = iso.length();
+    if (width == 0) width = max<size_t>(n, 1);
+    for (size_t pos = 0; pos < n; pos += width) {
+        iso.writeBases(out, pos, min(width, n - pos));
+        out.put('\n');
+    }
+}
+
+inline void fasta(OutputSink& out, string_view name, const Sequence& seq, size_t width = 60) {
+    out << '>' << name << '\n';
+    fastaBody(out, seq, width);
+}
+
+// ">id name"
+inline void fasta(OutputSink& out, const Isoform& iso, size_t width = 60) {
+    out << '>' << iso.getId() << ' ' << iso.getName() << '\n';
+    fastaBody(out, iso, width);
+}
+
+// Every isoform, tagged with its gene: ">id name gene=geneId"
+inline void fasta(OutputSink& out, const Gene& g, size_t width = 60) {
+    for (const Isoform& iso : g.getIsoforms()) {
+        out << '>' << iso.getId() << ' ' << iso.getName() << " gene=" << g.getId() << '\n';
+        fastaBody(out, iso, width);
+    }
+}
+
+// BED6: chrom, start, end, name (gene id), score, strand
+inline void bed(OutputSink& out, const Gene& g) {
+    out << g.getChrom() << '\t' << (g.getStart() - 1) << '\t' << g.getEnd() << '\t'
+        << g.getId() << "\t0\t" << g.getStrand() << '\n';
+}
+
+// One gene line, then a transcript line per isoform over the gene span
+inline void gtf(OutputSink& out, const Gene& g, string_view source = "lab5") {
+    auto columns = [&](string_view feature) {
+        out << g.getChrom() << '\t' << source << '\t' << feature << '\t'
+            << g.getStart() << '\t' << g.getEnd() << "\t.\t" << g.getStrand() << "\t.\t";
+    };
+    columns("gene");
+    out << "gene_id \"" << g.getId() << "\"; gene_name \"" << g.getName() << "\";\n";
+    for (const Isoform& iso : g.getIsoforms()) {
+        auto attributes = [&] {
+            out << "gene_id \"" << g.getId() << "\"; transcript_id \"" << iso.getId()
+                << "\"; gene_name \"" << g.getName() << "\"; transcript_name \"" << iso.getName() << "\";\n";
+        };
+        // Spliced isoforms know their exons; map them back to the genome
+        vector<pair<int, int>> exons;
+        for (const Isoform::Exon& e : iso.exonList()) {
+            int s = g.getStrand() == '-' ? g.getEnd() - int(e.start + e.len) + 1 : g.getStart() + int(e.start);
+            exons.push_back({ s, s + int(e.len) - 1 });
+        }
+        sort(exons.begin(), exons.end());
+
+        if (exons.empty()) {
+            columns("transcript");
+        } else {
+            out << g.getChrom() << '\t' << source << "\ttranscript\t" << exons.front().first << '\t'
+                << exons.back().second << "\t.\t" << g.getStrand() << "\t.\t";
+        }
+        attributes();
+        for (auto [s, e] : exons) {
+            out << g.getChrom() << '\t' << source << "\texon\t" << s << '\t' << e
+                << "\t.\t" << g.getStrand() << "\t.\t";
+            attributes();
+        }
+    }
+}
+
+inline void fasta(OutputSink& out, const vector<Gene>& genes, size_t width = 60) {
+    for (const Gene& g : genes) fasta(out, g, width);
+}
+
+inline void bed(OutputSink& out, const vector<Gene>& genes) {
+    for (const Gene& g : genes) bed(out, g);
+}
+
+inline void gtf(OutputSink& out, const vector<Gene>& genes, string_view source = "lab5") {
+    for (const Gene& g : genes) gtf(out, g, source);
+}
+
+inline void fasta(OutputSink& out, const GeneAnnotation& a, size_t width = 60) { fasta(out, a.all(), width); }
+inline void bed(OutputSink& out, const GeneAnnotation& a) { bed(out, a.all()); }
+inline void gtf(OutputSink& out, const GeneAnnotation& a, string_view source = "lab5") { gtf(out, a.all(), source); }
+
+}  // namespace emit
+
+/* ============================================================
+   AnnotationReader: parallel GTF / GFF3 loader
+   The file is mapped and cut into chunks at line boundaries;
+   each chunk is parsed on the thread pool into flat feature
+   records that point into the mapping (columns split with
+   memchr, coordinates read with from_chars). Genes, transcripts
+   and exons are then grouped by id in file order, and each gene
+   is built on the pool: with a reference its pre-mRNA is read
+   once and every transcript becomes a spliced isoform over it.
+   Coordinates are 1-based and inclusive, as in the file.
+   ============================================================ */
+class AnnotationReader {
+public:
+    enum class Format { Auto, GTF, GFF3 };
+
+private:
+    enum class Kind : uint8_t { Gene, Transcript, Exon };
+
+    // One gene/transcript/exon line; the views point into the mapping
+    struct Feature {
+        string_view chrom;
+        string_view geneId;
+        string_view geneName;
+        string_view txId;
+        string_view txName;
+        int32_t start;
+        int32_t end;
+        char strand;
+        Kind kind;
+    };
+
+    struct Chunk {
+        size_t begin, end;
+        vector<Feature> features;
+        size_t errorAt = validation::npos;      // file offset of a malformed line
+        string error;
+    };
+
+    struct GeneRec {
+        string_view chrom, id, name;
+        int32_t start, end;
+        char strand;
+        bool declared;                          // has its own gene line
+        vector<uint32_t> transcripts;
+    };
+
+    struct TxRec {
+        string_view id, name;
+        uint32_t gene;
+        vector<pair<int, int>> exons;
+    };
+
+    string path;
+    int fd = -1;
+    const char* map = nullptr;
+    size_t mapSize = 0;
+    size_t dataEnd = 0;         // a GFF3 ##FASTA section is not parsed
+    Format format;
+
+    static bool isGeneType(string_view t) {
+        return t == "gene" || t == "pseudogene"
+            || (t.size() > 5 && t.substr(t.size() - 5) == "_gene");
+    }
+
+    Format detect() const {
+        string_view text(map, mapSize);
+        if (text.substr(0, 15) == "##gff-version 3") return Format::GFF3;
+        for (size_t pos = 0; pos < text.size(); ) {
+            size_t nl = text.find('\n', pos);
+            string_view line = text.substr(pos, nl == string_view::npos ? string_view::npos : nl - pos);
+            pos = nl == string_view::npos ? text.size() : nl + 1;
+            if (line.empty() || line[0] == '#') continue;
+            // GFF3 attributes are key=value, GTF ones key "value"
+            size_t col = 0, at = 0;
+            while (col < 8 && (at = line.find('\t', at)) != string_view::npos) { ++at; ++col; }
+            if (col < 8) break;
+            string_view attrs = line.substr(at);
+            size_t eq = attrs.find('='), sp = attrs.find(' ');
+            return eq < sp ? Format::GFF3 : Format::GTF;
+        }
+        return Format::GTF;
+    }
+
+    // Calls f(key, value) for each attribute of column 9
+    template <typename F>
+    static void forEachAttribute(string_view a, bool gff3, F f) {
+        size_t p = 0;
+        while (p < a.size()) {
+            while (p < a.size() && (a[p] == ' ' || a[p] == ';')) ++p;
+            if (p >= a.size()) break;
+            size_t sep = a.find(gff3 ? '=' : ' ', p);
+            if (sep == string_view::npos) break;
+            string_view key = a.substr(p, sep - p);
+            p = sep + 1;
+            string_view value;
+            if (!gff3 && p < a.size() && a[p] == '"') {
+                size_t close = a.find('"', p + 1);
+                if (close == string_view::npos) close = a.size();
+                value = a.substr(p + 1, close - p - 1);
+                p = close + 1;
+            } else {
+                size_t stop = a.find(';', p);
+                if (stop == string_view::npos) stop = a.size();
+                value = a.substr(p, stop - p);
+                p = stop;
+            }
+            f(key, value);
+        }
+    }
+
+    // Parses [c.begin, c.end); stops at the first malformed line
+    void parseChunk(Chunk& c) const {
+        bool gff3 = format == Format::GFF3;
+        const char* p = map + c.begin;
+        const char* stop = map + c.end;
+        while (p < stop) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', size_t(stop - p)));
+            const char* lineEnd = nl ? nl : stop;
+            const char* next = nl ? nl + 1 : stop;
+            if (lineEnd > p && lineEnd[-1] == '\r') --lineEnd;
+            if (lineEnd == p || *p == '#') { p = next; continue; }
+
+            string_view col[9];
+            const char* q = p;
+            int n = 0;
+            for (; n < 8; ++n) {
+                const char* tab = static_cast<const char*>(memchr(q, '\t', size_t(lineEnd - q)));
+                if (!tab) break;
+                col[n] = string_view(q, size_t(tab - q));
+                q = tab + 1;
+            }
+            if (n < 8) {
+                c.errorAt = size_t(p - map);
+                c.error = "expected 9 tab-separated columns";
+                return;
+            }
+            col[8] = string_view(q, size_t(lineEnd - q));
+
+            string_view type = col[2];
+            Kind kind;
+            if (type == "exon") kind = Kind::Exon;
+            else if (gff3 ? isGeneType(type) : type == "gene") kind = Kind::Gene;
+            else if (gff3 || type == "transcript") kind = Kind::Transcript;
+            else { p = next; continue; }
+
+            Feature f{ col[0], {}, {}, {}, {}, 0, 0, col[6].empty() ? '.' : col[6][0], kind };
+            auto s = from_chars(col[3].data(), col[3].data() + col[3].size(), f.start);
+            auto e = from_chars(col[4].data(), col[4].data() + col[4].size(), f.end);
+            if (s.ec != errc() || e.ec != errc() || f.start < 1 || f.end < f.start) {
+                c.errorAt = size_t(p - map);
+                c.error = "bad coordinates";
+                return;
+            }
+
+            string_view id, parent, name;
+            forEachAttribute(col[8], gff3, [&](string_view key, string_view value) {
+                if (gff3) {
+                    if (key == "ID") id = value;
+                    else if (key == "Parent") parent = value;
+                    else if (key == "Name") name = value;
+                    else if (key == "gene_name") f.geneName = value;
+                    else if (key == "transcript_name") f.txName = value;
+                } else if (key == "gene_id") f.geneId = value;
+                else if (key == "transcript_id") f.txId = value;
+                else if (key == "gene_name") f.geneName = value;
+                else if (key == "transcript_name") f.txName = value;
+            });
+
+            if (gff3) {
+                // Genes: ID/Name. Transcripts: ID/Parent(gene)/Name. Exons: Parent(s)
+                if (kind == Kind::Gene) {
+                    f.geneId = id;
+                    if (!name.empty()) f.geneName = name;
+                } else if (kind == Kind::Transcript) {
+                    if (id.empty() || parent.empty()) { p = next; continue; }
+                    f.txId = id;
+                    f.geneId = parent;
+                    if (!name.empty()) f.txName = name;
+                } else {
+                    // An exon may be shared by several transcripts: Parent=a,b
+                    for (size_t from = 0; from <= parent.size(); ) {
+                        size_t comma = parent.find(',', from);
+                        if (comma == string_view::npos) comma = parent.size();
+                        if (comma > from) {
+                            f.txId = parent.substr(from, comma - from);
+                            c.features.push_back(f);
+                        }
+                        from = comma + 1;
+                    }
+                    p = next;
+                    continue;
+                }
+            }
+
+            if ((kind == Kind::Gene && f.geneId.empty())
+                || (kind != Kind::Gene && (gff3 ? f.txId.empty() : f.geneId.empty() || f.txId.empty()))) {
+                c.errorAt = size_t(p - map);
+                c.error = kind == Kind::Gene ? "gene without an id" : "missing gene_id or transcript_id";
+                return;
+            }
+            c.features.push_back(f);
+            p = next;
+        }
+    }
+
+    [[noreturn]] void fail(size_t offset, const string& what) const {
+        size_t line = 1 + size_t(count(map, map + offset, '\n'));
+        throw runtime_error("AnnotationReader: " + path + ":" + to_string(line) + ": " + what);
+    }
+
+public:
+    explicit AnnotationReader(const string& file, Format f = Format::Auto)
+        : path(file), format(f)
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("AnnotationReader: cannot open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); throw runtime_error("AnnotationReader: cannot stat " + path); }
+        mapSize = static_cast<size_t>(st.st_size);
+
+        if (mapSize > 0) {
+            void* m = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) { ::close(fd); throw runtime_error("AnnotationReader: cannot mmap " + path); }
+            madvise(m, mapSize, MADV_WILLNEED);
+            map = static_cast<const char*>(m);
+        }
+
+        if (mapSize >= 2 && uint8_t(map[0]) == 0x1f && uint8_t(map[1]) == 0x8b) {
+            release();
+            throw runtime_error("AnnotationReader: " + path + " is gzip-compressed; decompress it first");
+        }
+        if (format == Format::Auto) format = detect();
+
+        dataEnd = mapSize;
+        if (format == Format::GFF3) {
+            // GFF3 allows embedded sequences after a ##FASTA line
+            string_view text(map, mapSize);
+            size_t fasta = text.substr(0, 7) == "##FASTA" ? 0 : text.find("\n##FASTA");
+            if (fasta != string_view::npos) dataEnd = fasta;
+        }
+    }
+
+    AnnotationReader(const AnnotationReader&) = delete;
+    AnnotationReader& operator=(const AnnotationReader&) = delete;
+
+    ~AnnotationReader() {
+        release();
+    }
+
+    void release() {
+        if (map) munmap(const_cast<char*>(map), mapSize);
+        if (fd >= 0) ::close(fd);
+        map = nullptr;
+        fd = -1;
+    }
+
+    Format detectedFormat() const { return format; }
+
+    /* Parses the whole file into an indexed annotation. With a
+       reference, each gene gets its pre-mRNA and its transcripts
+       become spliced isoforms; without one, isoforms carry ids
+       only. Genes appear in the order of their first line. */
+    GeneAnnotation load(const ReferenceStore* reference = nullptr,
+                        ThreadPool& pool = ThreadPool::shared()) const {
+        // 1. Chunks ending at line boundaries
+        size_t target = min<size_t>(max<size_t>(dataEnd / (pool.size() * 4), size_t(1) << 20),
+                                    size_t(64) << 20);
+        vector<Chunk> chunks;
+        for (size_t b = 0; b < dataEnd; ) {
+            size_t e = min(dataEnd, b + target);
+            if (e < dataEnd) {
+                const void* nl = memchr(map + e, '\n', dataEnd - e);
+                e = nl ? size_t(static_cast<const char*>(nl) - map) + 1 : dataEnd;
+            }
+            chunks.push_back(Chunk{ b, e, {}, validation::npos, {} });
+            b = e;
+        }
+
+        // 2. Parse in parallel
+        pool.parallelFor(chunks.size(), 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) parseChunk(chunks[i]);
+        });
+        for (const Chunk& c : chunks)
+            if (c.errorAt != validation::npos) fail(c.errorAt, c.error);
+
+        // 3. Group by id in file order; GTF files without gene or
+        //    transcript lines get them from their exons
+        vector<GeneRec> genes;
+        vector<TxRec> txs;
+        unordered_map<string_view, uint32_t> geneIndex, txIndex;
+        size_t features = 0;
+        for (const Chunk& c : chunks) features += c.features.size();
+        txIndex.reserve(features / 4);
+
+        bool gff3 = format == Format::GFF3;
+        auto geneFor = [&](const Feature& f) -> uint32_t {
+            auto ins = geneIndex.emplace(f.geneId, uint32_t(genes.size()));
+            if (ins.second)
+                genes.push_back(GeneRec{ f.chrom, f.geneId, f.geneName, f.start, f.end, f.strand, false, {} });
+            GeneRec& g = genes[ins.first->second];
+            if (!g.declared) {
+                g.start = min(g.start, f.start);
+                g.end = max(g.end, f.end);
+            }
+            return ins.first->second;
+        };
+        auto txFor = [&](const Feature& f, uint32_t gene) -> uint32_t {
+            auto ins = txIndex.emplace(f.txId, uint32_t(txs.size()));
+            if (ins.second) {
+                txs.push_back(TxRec{ f.txId, f.txName, gene, {} });
+                genes[gene].transcripts.push_back(ins.first->second);
+            }
+            return ins.first->second;
+        };
+
+        for (const Chunk& c : chunks)
+            for (const Feature& f : c.features) {
+                if (f.kind != Kind::Gene) continue;
+                auto ins = geneIndex.emplace(f.geneId, uint32_t(genes.size()));
+                if (ins.second)
+                    genes.push_back(GeneRec{ f.chrom, f.geneId, f.geneName, f.start, f.end, f.strand, true, {} });
+            }
+        for (const Chunk& c : chunks)
+            for (const Feature& f : c.features) {
+                if (f.kind != Kind::Transcript) continue;
+                if (gff3) {
+                    // Only features whose parent is a gene are transcripts
+                    auto g = geneIndex.find(f.geneId);
+                    if (g != geneIndex.end()) txFor(f, g->second);
+                } else {
+                    txFor(f, geneFor(f));
+                }
+            }
+        for (const Chunk& c : chunks)
+            for (const Feature& f : c.features) {
+                if (f.kind != Kind::Exon) continue;
+                uint32_t tx;
+                auto t = txIndex.find(f.txId);
+                if (t != txIndex.end()) {
+                    tx = t->second;
+                    if (!gff3) geneFor(f);      // widens an undeclared gene
+                } else {
+                    if (gff3) continue;         // exon of a non-transcript parent
+                    uint32_t gene = geneFor(f);
+                    tx = txFor(f, gene);
+                }
+                txs[tx].exons.push_back({ f.start, f.end });
+            }
+
+        if (reference) {
+            for (const GeneRec& g : genes) {
+                const ReferenceStore::FaiEntry* e = reference->find(string(g.chrom));
+                if (!e)
+                    throw runtime_error("AnnotationReader: " + path + ": unknown chromosome " + string(g.chrom));
+                if (size_t(g.end) > e->length)
+                    throw runtime_error("AnnotationReader: " + path + ": gene " + string(g.id)
+                                        + " runs past the end of " + string(g.chrom));
+            }
+        }
+        for (const TxRec& t : txs) {
+            const GeneRec& g = genes[t.gene];
+            for (auto [s, e] : t.exons)
+                if (s < g.start || e > g.end)
+                    throw runtime_error("AnnotationReader: exon of " + string(t.id)
+                                        + " lies outside gene " + string(g.id));
+        }
+
+        // 4. Genes in file order, isoforms (and sequences) built on the pool
+        vector<Gene> out;
+        out.reserve(genes.size());
+        for (const GeneRec& g : genes)
+            out.emplace_back(g.id, g.name.empty() ? g.id : g.name, g.chrom, g.start, g.end, g.strand);
+
+        pool.parallelFor(out.size(), 64, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                Gene& gene = out[i];
+                const GeneRec& g = genes[i];
+                gene.reserveIsoforms(g.transcripts.size());
+                if (reference) gene.loadPreMRNA(*reference);
+                for (uint32_t ti : g.transcripts) {
+                    const TxRec& t = txs[ti];
+                    string_view name = t.name.empty() ? t.id : t.name;
+                    if (reference && !t.exons.empty()) gene.addSplicedIsoform(t.id, name, t.exons);
+                    else gene.emplaceIsoform(t.id, name, string_view());
+                }
+            }
+        });
+
+        GeneAnnotation annotation(move(out));
+        annotation.build();
+        return annotation;
+    }
+};
+
+/* ============================================================
+   GeneTable: struct-of-arrays view of a gene collection
+   Hot fields (chromosome, start, end, strand) sit in their own
+   contiguous columns, so a coordinate scan touches 13 bytes per
+   gene instead of whole Gene objects. Ids and names are Symbol
+   columns; isoforms are joined lazily through the source row.
+   Filters return selection vectors (row numbers); select()
+   gathers them into a new table.
+   ============================================================ */
+class GeneTable {
+public:
+    // CSR grouping: rows of group g are rows[offsets[g], offsets[g+1])
+    struct Groups {
+        vector<uint32_t> keys;
+        vector<uint32_t> offsets;
+        vector<uint32_t> rows;
+
+        size_t size() const { return keys.size(); }
+    };
+
+private:
+    const vector<Gene>* source = nullptr;
+    vector<uint32_t> chrom;     // Symbol ids
+    vector<int32_t> start;      // 1-based, inclusive, like Gene
+    vector<int32_t> end;
+    vector<char> strand;
+    vector<Symbol> id;
+    vector<Symbol> name;
+    vector<uint32_t> sourceRow;
+
+    // Rows overlapping [from, to] on chromosome c; strand 0 matches any
+    static size_t filterScalar(const uint32_t* ch, const int32_t* st, const int32_t* en,
+                               const char* sd, size_t b, size_t e, uint32_t c,
+                               int32_t from, int32_t to, char want, uint32_t* out) {
+        size_t n = 0;
+        for (size_t i = b; i < e; ++i) {
+            out[n] = uint32_t(i);
+            n += (ch[i] == c) & (st[i] <= to) & (en[i] >= from) & (want == 0 || sd[i] == want);
+        }
+        return n;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Eight rows per step; matching lanes are appended via the movemask bits
+    __attribute__((target("avx2,popcnt")))
+    static size_t filterAVX2(const uint32_t* ch, const int32_t* st, const int32_t* en,
+                             const char* sd, size_t b, size_t e, uint32_t c,
+                             int32_t from, int32_t to, char want, uint32_t* out) {
+        const __m256i vc = _mm256_set1_epi32(int(c));
+        const __m256i vfrom = _mm256_set1_epi32(from);
+        const __m256i vto = _mm256_set1_epi32(to);
+        const __m256i vwant = _mm256_set1_epi32(want);
+        size_t n = 0, i = b;
+        for (; i + 8 <= e; i += 8) {
+            __m256i mc = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ch + i)), vc);
+            // Outside when start > to or from > end
+            __m256i out1 = _mm256_cmpgt_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(st + i)), vto);
+            __m256i out2 = _mm256_cmpgt_epi32(vfrom, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(en + i)));
+            __m256i m = _mm256_andnot_si256(_mm256_or_si256(out1, out2), mc);
+            if (want) {
+                __m256i s = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(sd + i)));
+                m = _mm256_and_si256(m, _mm256_cmpeq_epi32(s, vwant));
+            }
+            unsigned bits = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+            while (bits) {
+                out[n++] = uint32_t(i + __builtin_ctz(bits));
+                bits &= bits - 1;
+            }
+        }
+        return n + filterScalar(ch, st, en, sd, i, e, c, from, to, want, out + n);
+    }
+#endif
+
+    // groupBy() with hashed slots, for keys spread too wide for an array
+    static Groups groupBySparse(const vector<uint32_t>& key) {
+        Groups g;
+        unordered_map<uint32_t, uint32_t> slot;
+        vector<uint32_t> groupOf(key.size());
+        vector<uint32_t> counts;
+        for (size_t r = 0; r < key.size(); ++r) {
+            auto ins = slot.emplace(key[r], uint32_t(g.keys.size()));
+            if (ins.second) { g.keys.push_back(key[r]); counts.push_back(0); }
+            groupOf[r] = ins.first->second;
+            ++counts[groupOf[r]];
+        }
+        g.offsets.assign(g.keys.size() + 1, 0);
+        for (size_t k = 0; k < counts.size(); ++k) g.offsets[k + 1] = g.offsets[k] + counts[k];
+        vector<uint32_t> fill(g.offsets.begin(), g.offsets.end() - 1);
+        g.rows.resize(key.size());
+        for (size_t r = 0; r < key.size(); ++r) g.rows[fill[groupOf[r]]++] = uint32_t(r);
+        return g;
+    }
+
+public:
+    GeneTable() = default;
+
+    explicit GeneTable(const vector<Gene>& genes) : source(&genes) {
+        size_t n = genes.size();
+        chrom.reserve(n); start.reserve(n); end.reserve(n); strand.reserve(n);
+        id.reserve(n); name.reserve(n); sourceRow.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            const Gene& g = genes[i];
+            chrom.push_back(g.chromSymbol().id());
+            start.push_back(g.getStart());
+            end.push_back(g.getEnd());
+            strand.push_back(g.getStrand());
+            id.push_back(g.idSymbol());
+            name.push_back(g.nameSymbol());
+            sourceRow.push_back(uint32_t(i));
+        }
+    }
+
+    explicit GeneTable(const GeneAnnotation& annotation) : GeneTable(annotation.all()) {}
+
+    size_t size() const { return start.size(); }
+
+    Symbol chromAt(size_t r) const { return Symbol(chrom[r]); }
+    int startAt(size_t r) const { return start[r]; }
+    int endAt(size_t r) const { return end[r]; }
+    char strandAt(size_t r) const { return strand[r]; }
+    Symbol idAt(size_t r) const { return id[r]; }
+    Symbol nameAt(size_t r) const { return name[r]; }
+
+    const vector<uint32_t>& chromColumn() const { return chrom; }
+    const vector<int32_t>& startColumn() const { return start; }
+    const vector<int32_t>& endColumn() const { return end; }
+    const vector<char>& strandColumn() const { return strand; }
+
+    // Lazy join back to the source objects (the source must outlive the table)
+    const Gene& gene(size_t r) const { return (*source)[sourceRow[r]]; }
+    const pmr::vector<Isoform>& isoforms(size_t r) const { return gene(r).getIsoforms(); }
+
+    // Rows overlapping chrom:[from, to] (1-based, inclusive), in row order
+    vector<uint32_t> filterRange(Symbol c, int from, int to, char want = 0) const {
+        vector<uint32_t> out(size());
+        if (want == '.') want = 0;
+        size_t n;
+#if defined(__x86_64__) || defined(__i386__)
+        if (validation::activeKernel() == validation::Kernel::AVX2)
+            n = filterAVX2(chrom.data(), start.data(), end.data(), strand.data(), 0, size(),
+                           c.id(), from, to, want, out.data());
+        else
+#endif
+            n = filterScalar(chrom.data(), start.data(), end.data(), strand.data(), 0, size(),
+                             c.id(), from, to, want, out.data());
+        out.resize(n);
+        return out;
+    }
+
+    vector<uint32_t> filterRange(const string& c, int from, int to, char want = 0) const {
+        Symbol s = SymbolTable::global().find(c);
+        return s.empty() ? vector<uint32_t>() : filterRange(s, from, to, want);
+    }
+
+    // Rows where pred(table, row) holds
+    template <typename Pred>
+    vector<uint32_t> filter(Pred pred) const {
+        vector<uint32_t> out;
+        for (size_t r = 0; r < size(); ++r)
+            if (pred(*this, r)) out.push_back(uint32_t(r));
+        return out;
+    }
+
+    // New table holding the given rows, in that order
+    GeneTable select(const vector<uint32_t>& rows) const {
+        GeneTable t;
+        t.source = source;
+        auto gather = [&rows](const auto& col, auto& dst) {
+            dst.resize(rows.size());
+            for (size_t i = 0; i < rows.size(); ++i) dst[i] = col[rows[i]];
+        };
+        gather(chrom, t.chrom); gather(start, t.start); gather(end, t.end);
+        gather(strand, t.strand); gather(id, t.id); gather(name, t.name);
+        gather(sourceRow, t.sourceRow);
+        return t;
+    }
+
+    /* Row order by (chromosome, start, end). Chromosomes compare by
+       Symbol, i.e. first-seen order, not alphabetically. The three
+       fields are packed into one integer key per row. */
+    vector<uint32_t> positionOrder() const {
+        vector<pair<unsigned __int128, uint32_t>> keyed(size());
+        for (size_t r = 0; r < size(); ++r) {
+            unsigned __int128 k = (unsigned __int128)chrom[r] << 64
+                                | uint64_t(uint32_t(start[r]) ^ 0x80000000u) << 32
+                                | (uint32_t(end[r]) ^ 0x80000000u);
+            keyed[r] = { k, uint32_t(r) };
+        }
+        sort(keyed.begin(), keyed.end());
+        vector<uint32_t> order(size());
+        for (size_t r = 0; r < size(); ++r) order[r] = keyed[r].second;
+        return order;
+    }
+
+    void sortByPosition() { *this = select(positionOrder()); }
+
+    /* Groups rows by a uint32 key column (first-seen key order, rows in
+       row order). Keys are Symbol ids or strand letters, so they span a
+       narrow range: one counting pass over a dense slot array, a prefix
+       sum and a scatter, no hashing. Keys spread wider than the table
+       fall back to a hash map for the slots. */
+    static Groups groupBy(const vector<uint32_t>& key) {
+        Groups g;
+        size_t n = key.size();
+        g.offsets.assign(1, 0);
+        if (n == 0) return g;
+
+        auto [lo, hi] = minmax_element(key.begin(), key.end());
+        uint32_t base = *lo;
+        size_t range = size_t(*hi - *lo) + 1;
+        if (range > max<size_t>(n * 4, size_t(1) << 16)) return groupBySparse(key);
+
+        const uint32_t NONE = UINT32_MAX;
+        vector<uint32_t> slot(range, NONE);
+        vector<uint32_t> counts;
+        for (size_t r = 0; r < n; ++r) {
+            uint32_t& s = slot[key[r] - base];
+            if (s == NONE) {
+                s = uint32_t(g.keys.size());
+                g.keys.push_back(key[r]);
+                counts.push_back(0);
+            }
+            ++counts[s];
+        }
+        g.offsets.resize(g.keys.size() + 1);
+        for (size_t k = 0; k < counts.size(); ++k) g.offsets[k + 1] = g.offsets[k] + counts[k];
+        vector<uint32_t> fill(g.offsets.begin(), g.offsets.end() - 1);
+        g.rows.resize(n);
+        for (size_t r = 0; r < n; ++r) g.rows[fill[slot[key[r] - base]]++] = uint32_t(r);
+        return g;
+    }
+
+    // keys are Symbol ids
+    Groups groupByChrom() const { return groupBy(chrom); }
+
+    Groups groupByStrand() const {
+        vector<uint32_t> key(strand.begin(), strand.end());
+        return groupBy(key);
+    }
+
+    // Sum of end - start + 1 over the rows (e.g. one group)
+    uint64_t totalSpan(const uint32_t* rows, size_t n) const {
+        uint64_t s = 0;
+        for (size_t i = 0; i < n; ++i) s += uint64_t(end[rows[i]] - start[rows[i]] + 1);
+        return s;
+    }
+};
+
+/* ============================================================
+   GeneticCode: one NCBI translation table as 64 entries indexed
+   the way codons sit in PackedBases words, i.e. six bits
+   c0 | c1 << 2 | c2 << 4 (A=0, C=1, G=2, T/U=3). Ambiguous
+   codons translate to 'X', stops to '*'.
+   ============================================================ */
+class GeneticCode {
+private:
+    int id;
+    string name;
+    array<char, 64> aa;
+    uint64_t starts = 0;    // bit per codon index
+
+    // NCBI tables list codons in TCAG order, first base slowest
+    GeneticCode(int i, string n, const char* aas, const char* startMarks)
+        : id(i), name(move(n)) {
+        static const int ncbiOrder[4] = { 2, 1, 3, 0 };     // A C G T -> TCAG rank
+        for (unsigned c = 0; c < 64; ++c) {
+            int pos = ncbiOrder[c & 3] * 16 + ncbiOrder[(c >> 2) & 3] * 4 + ncbiOrder[c >> 4];
+            aa[c] = aas[pos];
+            if (startMarks[pos] == 'M') starts |= 1ULL << c;
+        }
+    }
+
+public:
+    static constexpr uint8_t AMBIGUOUS = 0xFF;
+
+    // Codon index of three bases (any case, T or U); AMBIGUOUS otherwise
+    static uint8_t codonIndex(char b0, char b1, char b2) {
+        auto code = [](char b) -> int {
+            switch (b | 0x20) {
+                case 'a': return 0;
+                case 'c': return 1;
+                case 'g': return 2;
+                case 't': case 'u': return 3;
+                default: return -1;
+            }
+        };
+        int c0 = code(b0), c1 = code(b1), c2 = code(b2);
+        if ((c0 | c1 | c2) < 0) return AMBIGUOUS;
+        return uint8_t(c0 | c1 << 2 | c2 << 4);
+    }
+
+    static const GeneticCode& standard() { return byId(1); }
+
+    // NCBI transl_table ids 1-5 and 11; throws invalid_argument otherwise
+    static const GeneticCode& byId(int ncbiId) {
+        static const GeneticCode tables[] = {
+            { 1, "Standard",
+              "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+              "---M------**--*----M---------------M----------------------------" },
+            { 2, "Vertebrate Mitochondrial",
+              "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSS**VVVVAAAADDEEGGGG",
+              "----------**--------------------MMMM----------**---M------------" },
+            { 3, "Yeast Mitochondrial",
+              "FFLLSSSSYY**CCWWTTTTPPPPHHQQRRRRIIMMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+              "----------**----------------------MM---------------M------------" },
+            { 4, "Mold, Protozoan and Coelenterate Mitochondrial",
+              "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+              "--MM------**-------M------------MMMM---------------M------------" },
+            { 5, "Invertebrate Mitochondrial",
+              "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSSSVVVVAAAADDEEGGGG",
+              "---M------**--------------------MMMM---------------M------------" },
+            { 11, "Bacterial, Archaeal and Plant Plastid",
+              "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+              "---M------**--*----M------------MMMM---------------M------------" },
+        };
+        for (const GeneticCode& t : tables)
+            if (t.id == ncbiId) return t;
+        throw invalid_argument("GeneticCode: unsupported table " + to_string(ncbiId));
+    }
+
+    int getId() const { return id; }
+    const string& getName() const { return name; }
+
+    char translate(uint8_t codon) const { return codon == AMBIGUOUS ? 'X' : aa[codon]; }
+    bool isStop(uint8_t codon) const { return codon != AMBIGUOUS && aa[codon] == '*'; }
+    bool isStart(uint8_t codon) const { return codon != AMBIGUOUS && (starts >> codon & 1); }
+};
+
+/* ============================================================
+   Translator: RNA/DNA -> ProteinSequence under a GeneticCode
+   Codons are read straight from the packed words, ten per
+   64-bit window, and looked up in the 64-entry table; codons
+   touching an ambiguity run become 'X'. The reverse strand is
+   a word-level reverse complement, so the six frames never
+   unpack the sequence.
+   ============================================================ */
+class Translator {
+public:
+    struct ORF {
+        size_t start;       // 0-based, half-open, forward-strand coordinates
+        size_t end;         // includes the stop codon
+        int frame;          // +1..+3 or -1..-3
+        size_t codons;      // residues, stop excluded
+    };
+
+    static constexpr uint8_t ATG = 0 | 3 << 2 | 2 << 4;
+
+private:
+    const GeneticCode* code;
+
+    // out[k] = index of the codon starting at from + 3k, k < count
+    static void codonIndices(const PackedBases& pb, size_t from, size_t count, uint8_t* out) {
+        const pmr::vector<uint64_t>& w = pb.packedWords();
+        size_t k = 0;
+        for (; k < count; k += 10) {
+            size_t bit = (from + 3 * k) * 2, wi = bit >> 6, sh = bit & 63;
+            uint64_t v = w[wi] >> sh;
+            if (sh > 4 && wi + 1 < w.size()) v |= w[wi + 1] << (64 - sh);
+            size_t m = min<size_t>(10, count - k);
+            for (size_t j = 0; j < m; ++j, v >>= 6)
+                out[k + j] = uint8_t(v & 63);
+        }
+        // Codons overlapping an ambiguity run
+        size_t end = from + 3 * count;
+        for (const PackedBases::Run& r : pb.ambiguityRuns()) {
+            size_t rs = max(r.start, from), re = min(r.start + r.len, end);
+            if (rs >= re) continue;
+            for (size_t c = (rs - from) / 3; c <= (re - 1 - from) / 3; ++c)
+                out[c] = GeneticCode::AMBIGUOUS;
+        }
+    }
+
+    string translateRange(const PackedBases& pb, size_t from, size_t count) const {
+        vector<uint8_t> idx(count);
+        if (count) codonIndices(pb, from, count, idx.data());
+        string out(count, '\0');
+        for (size_t k = 0; k < count; ++k) out[k] = code->translate(idx[k]);
+        return out;
+    }
+
+    static size_t frameCodons(size_t n, size_t offset) {
+        return n > offset ? (n - offset) / 3 : 0;
+    }
+
+    template <typename F>
+    void scanORFs(const PackedBases& pb, int sign, size_t minCodons, bool atgOnly, F emit) const {
+        size_t n = pb.size();
+        vector<uint8_t> idx;
+        for (size_t f = 0; f < 3; ++f) {
+            size_t count = frameCodons(n, f);
+            idx.resize(count);
+            if (count) codonIndices(pb, f, count, idx.data());
+            size_t open = SIZE_MAX;
+            for (size_t k = 0; k < count; ++k) {
+                uint8_t c = idx[k];
+                if (open == SIZE_MAX) {
+                    if (atgOnly ? c == ATG : code->isStart(c)) open = k;
+                } else if (code->isStop(c)) {
+                    if (k - open >= minCodons) {
+                        size_t s = f + 3 * open, e = f + 3 * (k + 1);
+                        if (sign < 0) { size_t t = n - e; e = n - s; s = t; }
+                        emit(ORF{ s, e, sign * int(f + 1), k - open });
+                    }
+                    open = SIZE_MAX;
+                }
+            }
+        }
+    }
+
+public:
+    explicit Translator(const GeneticCode& c = GeneticCode::standard()) : code(&c) {}
+
+    const GeneticCode& geneticCode() const { return *code; }
+
+    // Frame 0-2 from the first base; stops appear as '*' unless toStop
+    ProteinSequence translate(const NucleotideSequence& s, size_t frame = 0,
+                              bool toStop = false) const {
+        PackedBases tmp;
+        const PackedBases& pb = s.packedBases(tmp);
+        string p = translateRange(pb, frame, frameCodons(pb.size(), frame));
+        if (toStop) p.resize(min(p.size(), p.find('*')));
+        return ProteinSequence(p);
+    }
+
+    // Frames +1, +2, +3, -1, -2, -3, full length with '*' at stops
+    array<ProteinSequence, 6> sixFrame(const NucleotideSequence& s) const {
+        PackedBases tmp;
+        const PackedBases& fwd = s.packedBases(tmp);
+        PackedBases rev = fwd;
+        rev.reverseComplement();
+        size_t n = fwd.size();
+        return { ProteinSequence(translateRange(fwd, 0, frameCodons(n, 0))),
+                 ProteinSequence(translateRange(fwd, 1, frameCodons(n, 1))),
+                 ProteinSequence(translateRange(fwd, 2, frameCodons(n, 2))),
+                 ProteinSequence(translateRange(rev, 0, frameCodons(n, 0))),
+                 ProteinSequence(translateRange(rev, 1, frameCodons(n, 1))),
+                 ProteinSequence(translateRange(rev, 2, frameCodons(n, 2))) };
+    }
+
+    /* Start-to-stop ORFs of at least minCodons residues in all six
+       frames; each stop closes the longest ORF (first start) before
+       it. atgOnly ignores the table's alternative start codons. */
+    vector<ORF> findORFs(const NucleotideSequence& s, size_t minCodons = 30,
+                         bool atgOnly = true) const {
+        PackedBases tmp;
+        const PackedBases& fwd = s.packedBases(tmp);
+        PackedBases rev = fwd;
+        rev.reverseComplement();
+        vector<ORF> out;
+        auto emit = [&out](const ORF& o) { out.push_back(o); };
+        scanORFs(fwd, 1, minCodons, atgOnly, emit);
+        scanORFs(rev, -1, minCodons, atgOnly, emit);
+        sort(out.begin(), out.end(), [](const ORF& a, const ORF& b) {
+            return a.start != b.start ? a.start < b.start : a.end < b.end;
+        });
+        return out;
+    }
+
+    // Protein of an ORF: starts with 'M' (alternative starts too), no stop
+    ProteinSequence translate(const NucleotideSequence& s, const ORF& orf) const {
+        PackedBases tmp;
+        const PackedBases& fwd = s.packedBases(tmp);
+        string p;
+        if (orf.frame > 0) {
+            p = translateRange(fwd, orf.start, orf.codons);
+        } else {
+            PackedBases rev = fwd;
+            rev.reverseComplement();
+            p = translateRange(rev, fwd.size() - orf.end, orf.codons);
+        }
+        if (!p.empty()) p[0] = 'M';
+        return ProteinSequence(p);
+    }
+
+    /* Transcript -> protein by the scanning rule: from the first AUG
+       to the first in-frame stop (or the end). Empty if no AUG. */
+    ProteinSequence translateTranscript(const NucleotideSequence& s) const {
+        PackedBases tmp;
+        const PackedBases& pb = s.packedBases(tmp);
+        size_t n = pb.size();
+        // One codonIndices pass per frame, then the earliest ATG of the three
+        vector<uint8_t> idx[3];
+        size_t bestFrame = 3, bestPos = SIZE_MAX;
+        for (size_t f = 0; f < 3; ++f) {
+            idx[f].resize(frameCodons(n, f));
+            if (idx[f].empty()) continue;
+            codonIndices(pb, f, idx[f].size(), idx[f].data());
+            auto atg = find(idx[f].begin(), idx[f].end(), ATG);
+            size_t pos = f + 3 * size_t(atg - idx[f].begin());
+            if (atg != idx[f].end() && pos < bestPos) { bestPos = pos; bestFrame = f; }
+        }
+        if (bestFrame == 3) return ProteinSequence("");
+
+        string p;
+        for (size_t k = (bestPos - bestFrame) / 3; k < idx[bestFrame].size(); ++k) {
+            char aa = code->translate(idx[bestFrame][k]);
+            if (aa == '*') break;
+            p += aa;
+        }
+        return ProteinSequence(p);
+    }
+
+    struct Batch {
+        vector<size_t> offsets;             // gene g owns proteins[offsets[g], offsets[g+1])
+        vector<ProteinSequence> proteins;   // in isoform order
+    };
+
+    // Every isoform of every gene, translated on the pool
+    Batch translateAll(const vector<Gene>& genes,
+                       ThreadPool& pool = ThreadPool::shared(), size_t grain = 64) const {
+        Batch b;
+        vector<const Isoform*> isoforms;
+        b.offsets.reserve(genes.size() + 1);
+        b.offsets.push_back(0);
+        for (const Gene& g : genes) {
+            for (const Isoform& iso : g.getIsoforms()) isoforms.push_back(&iso);
+            b.offsets.push_back(isoforms.size());
+        }
+
+        b.proteins.reserve(isoforms.size());
+        for (size_t i = 0; i < isoforms.size(); ++i) b.proteins.emplace_back("");
+        pool.parallelFor(isoforms.size(), grain, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; ++i)
+                b.proteins[i] = translateTranscript(isoforms[i]->sequence());
+        });
+        return b;
+    }
+
+    Batch translateAll(const GeneAnnotation& annotation,
+                       ThreadPool& pool = ThreadPool::shared(), size_t grain = 64) const {
+        return translateAll(annotation.all(), pool, grain);
+    }
+};
+
+/* ============================================================
+   K-mer counting
+   K-mers are 2-bit encoded with the first base most significant
+   (A=0, C=1, G=2, T/U=3) and rolled along the packed words;
+   ambiguity runs restart the window. Canonical counting keys
+   each k-mer by the smaller of it and its reverse complement.
+   uint64_t keys hold k <= 32, unsigned __int128 keys k <= 64.
+   ============================================================ */
+namespace kmer {
+
+using Key64 = uint64_t;
+using Key128 = unsigned __int128;
+
+template <typename Key>
+constexpr unsigned maxK() { return sizeof(Key) * 4; }
+
+template <typename Key>
+Key mask(unsigned k) {
+    return k == maxK<Key>() ? ~Key(0) : (Key(1) << (2 * k)) - 1;
+}
+
+inline uint64_t mix(uint64_t x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+inline uint64_t hash(Key64 k) { return mix(k); }
+inline uint64_t hash(Key128 k) { return mix(uint64_t(k) ^ mix(uint64_t(k >> 64))); }
+
+// Encodes k bases of text (ACGTU, any case); false if another letter occurs
+template <typename Key>
+bool encode(string_view text, Key& out) {
+    out = 0;
+    for (char c : text) {
+        switch (c | 0x20) {
+            case 'a': out = out << 2 | Key(0); break;
+            case 'c': out = out << 2 | Key(1); break;
+            case 'g': out = out << 2 | Key(2); break;
+            case 't': case 'u': out = out << 2 | Key(3); break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+template <typename Key>
+string decode(Key key, unsigned k, char fourth = 'T') {
+    const char letters[4] = { 'A', 'C', 'G', fourth };
+    string s(k, 'A');
+    for (unsigned i = k; i-- > 0; key >>= 2) s[i] = letters[unsigned(key & 3)];
+    return s;
+}
+
+template <typename Key>
+Key reverseComplement(Key key, unsigned k) {
+    Key r = 0;
+    for (unsigned i = 0; i < k; ++i, key >>= 2) r = r << 2 | (3 - (key & 3));
+    return r;
+}
+
+/* Calls f(key, pos) for every k-mer starting in [from, to) of pb
+   (pos = its first base). Windows covering an ambiguous base are
+   skipped. */
+template <typename Key, typename F>
+void forEach(const PackedBases& pb, unsigned k, bool canonical, size_t from, size_t to, F f) {
+    to = min(to, pb.size() >= k ? pb.size() - k + 1 : 0);
+    if (from >= to) return;
+    const pmr::vector<uint64_t>& words = pb.packedWords();
+    const pmr::vector<PackedBases::Run>& runs = pb.ambiguityRuns();
+    const Key m = mask<Key>(k);
+    const unsigned topShift = 2 * (k - 1);
+
+    auto run = lower_bound(runs.begin(), runs.end(), from,
+                           [](const PackedBases::Run& r, size_t p) { return r.start + r.len <= p; });
+    Key fwd = 0, rev = 0;
+    size_t filled = 0;
+    size_t last = to + k - 1;       // one past the last base read
+    for (size_t i = from; i < last; ) {
+        if (run != runs.end() && i >= run->start) {
+            i = run->start + run->len;
+            ++run;
+            filled = 0;
+            continue;
+        }
+        // Bases up to the next run come straight from the words
+        size_t stop = (run != runs.end()) ? min<size_t>(last, run->start) : last;
+        for (; i < stop; ++i) {
+            unsigned c = unsigned(words[i >> 5] >> ((i & 31) * 2)) & 3;
+            fwd = ((fwd << 2) | Key(c)) & m;
+            rev = (rev >> 2) | (Key(3 - c) << topShift);
+            if (++filled >= k) f(canonical && rev < fwd ? rev : fwd, i + 1 - k);
+        }
+    }
+}
+
+}  // namespace kmer
+
+/* ============================================================
+   KmerTable: concurrent open-addressing counts, split into
+   shards by the high hash bits. A slot is claimed by a CAS on
+   its state byte (empty -> writing -> ready), so 128-bit keys
+   need no double-width atomics; counts are atomic adds. add()
+   never blocks or grows: it returns false when the shard is at
+   its load limit, and grow() rehashes those shards between
+   batches while no adds run.
+   ============================================================ */
+template <typename Key>
+class KmerTable {
+private:
+    enum : uint8_t { EMPTY = 0, WRITING = 1, READY = 2 };
+
+    struct Slot {
+        atomic<uint8_t> state{ EMPTY };
+        Key key{};
+        atomic<uint64_t> count{ 0 };
+    };
+
+    struct Shard {
+        unique_ptr<Slot[]> slots;
+        size_t mask = 0;
+        atomic<size_t> used{ 0 };
+
+        size_t limit() const { return (mask + 1) / 4 * 3; }
+    };
+
+    vector<Shard> shards;
+    unsigned shardBits;
+
+    static void insertUnique(Shard& s, Key key, uint64_t count, uint64_t h) {
+        for (size_t i = h & s.mask; ; i = (i + 1) & s.mask) {
+            Slot& slot = s.slots[i];
+            if (slot.state.load(memory_order_relaxed) == EMPTY) {
+                slot.key = key;
+                slot.count.store(count, memory_order_relaxed);
+                slot.state.store(READY, memory_order_relaxed);
+                s.used.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    static void allocate(Shard& s, size_t capacity) {
+        s.slots.reset(new Slot[capacity]);
+        s.mask = capacity - 1;
+        s.used.store(0, memory_order_relaxed);
+    }
+
+public:
+    // Total capacity is rounded up to a power of two per shard
+    explicit KmerTable(size_t expectedKeys = size_t(1) << 20, unsigned bits = 6)
+        : shards(size_t(1) << bits), shardBits(bits) {
+        size_t perShard = 16;
+        while (perShard / 4 * 3 * shards.size() < expectedKeys) perShard <<= 1;
+        for (Shard& s : shards) allocate(s, perShard);
+    }
+
+    // Adds n to key's count; false if the key is new and its shard is full
+    bool add(Key key, uint64_t n = 1) {
+        uint64_t h = kmer::hash(key);
+        Shard& s = shards[shardBits ? h >> (64 - shardBits) : 0];
+        for (size_t i = h & s.mask; ; i = (i + 1) & s.mask) {
+            Slot& slot = s.slots[i];
+            uint8_t st = slot.state.load(memory_order_acquire);
+            if (st == EMPTY) {
+                // Reserve room first, so the shard never fills past its limit
+                if (s.used.fetch_add(1, memory_order_relaxed) >= s.limit()) {
+                    s.used.fetch_sub(1, memory_order_relaxed);
+                    return false;
+                }
+                if (!slot.state.compare_exchange_strong(st, WRITING, memory_order_acquire)) {
+                    s.used.fetch_sub(1, memory_order_relaxed);
+                    --i;    // lost the race: look at this slot again
+                    continue;
+                }
+                slot.key = key;
+                slot.count.fetch_add(n, memory_order_relaxed);
+                slot.state.store(READY, memory_order_release);
+                return true;
+            }
+            while (st == WRITING) st = slot.state.load(memory_order_acquire);
+            if (slot.key == key) {
+                slot.count.fetch_add(n, memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    // Doubles every shard at its load limit; not concurrent with add()
+    void grow(ThreadPool& pool = ThreadPool::shared()) {
+        pool.parallelFor(shards.size(), 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                Shard& s = shards[i];
+                if (s.used.load(memory_order_relaxed) < s.limit()) continue;
+                unique_ptr<Slot[]> old = move(s.slots);
+                size_t oldCapacity = s.mask + 1;
+                allocate(s, oldCapacity * 2);
+                for (size_t j = 0; j < oldCapacity; ++j)
+                    if (old[j].state.load(memory_order_relaxed) == READY)
+                        insertUnique(s, old[j].key, old[j].count.load(memory_order_relaxed),
+                                     kmer::hash(old[j].key));
+            }
+        });
+    }
+
+    uint64_t get(Key key) const {
+        uint64_t h = kmer::hash(key);
+        const Shard& s = shards[shardBits ? h >> (64 - shardBits) : 0];
+        for (size_t i = h & s.mask; ; i = (i + 1) & s.mask) {
+            const Slot& slot = s.slots[i];
+            if (slot.state.load(memory_order_acquire) != READY) return 0;
+            if (slot.key == key) return slot.count.load(memory_order_relaxed);
+        }
+    }
+
+    // Calls f(key, count) for every key; not concurrent with add()
+    template <typename F>
+    void forEach(F f) const {
+        for (const Shard& s : shards)
+            for (size_t i = 0; i <= s.mask; ++i)
+                if (s.slots[i].state.load(memory_order_relaxed) == READY)
+                    f(s.slots[i].key, s.slots[i].count.load(memory_order_relaxed));
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const Shard& s : shards) n += s.used.load(memory_order_relaxed);
+        return n;
+    }
+
+    size_t memoryUsage() const {
+        size_t n = 0;
+        for (const Shard& s : shards) n += (s.mask + 1) * sizeof(Slot);
+        return n;
+    }
+};
+
+/* ============================================================
+   KmerCounter: k-mer spectrum of a sequence collection
+   count() splits the input into segments (long sequences into
+   several, overlapping by k-1 bases) and counts them on the
+   pool in rounds of about roundBases bases. K-mers that land in
+   a full shard are set aside, the table grows, and they are
+   re-added before the next round. Protein sequences are skipped.
+   ============================================================ */
+template <typename Key>
+class KmerCounter {
+private:
+    unsigned k;
+    bool canonical;
+    KmerTable<Key> table;
+    uint64_t total = 0;
+
+    struct Segment {
+        const PackedBases* bases;
+        size_t from;
+        size_t to;          // k-mer start positions [from, to)
+    };
+
+    void addAll(vector<Key>& pending, ThreadPool& pool) {
+        while (!pending.empty()) {
+            table.grow(pool);
+            vector<Key> again;
+            for (Key key : pending)
+                if (!table.add(key)) again.push_back(key);
+            pending.swap(again);
+        }
+    }
+
+    void countSegments(const vector<Segment>& segs, ThreadPool& pool) {
+        mutex overflowLock;
+        vector<Key> overflow;
+        atomic<uint64_t> seen{ 0 };
+        pool.parallelFor(segs.size(), 1, [&](size_t b, size_t e) {
+            vector<Key> local;
+            uint64_t n = 0;
+            for (size_t i = b; i < e; ++i)
+                kmer::forEach<Key>(*segs[i].bases, k, canonical, segs[i].from, segs[i].to,
+                                   [&](Key key, size_t) {
+                                       ++n;
+                                       if (!table.add(key)) local.push_back(key);
+                                   });
+            seen.fetch_add(n, memory_order_relaxed);
+            if (!local.empty()) {
+                lock_guard<mutex> g(overflowLock);
+                overflow.insert(overflow.end(), local.begin(), local.end());
+            }
+        });
+        total += seen.load();
+        addAll(overflow, pool);
+    }
+
+public:
+    static constexpr size_t segmentBases = size_t(1) << 20;
+    static constexpr size_t roundBases = size_t(1) << 24;
+
+    explicit KmerCounter(unsigned kmerLength, bool canonicalKmers = true,
+                         size_t expectedDistinct = size_t(1) << 16)
+        : k(kmerLength), canonical(canonicalKmers), table(expectedDistinct) {
+        if (k == 0 || k > kmer::maxK<Key>())
+            throw invalid_argument("KmerCounter: k must be 1-" + to_string(kmer::maxK<Key>()) +
+                                   " for this key width");
+    }
+
+    unsigned kmerLength() const { return k; }
+    bool isCanonical() const { return canonical; }
+
+    // Counts one sequence on the calling thread
+    void add(const NucleotideSequence& s) {
+        PackedBases scratch;
+        const PackedBases& pb = s.packedBases(scratch);
+        vector<Key> pending;
+        kmer::forEach<Key>(pb, k, canonical, 0, pb.size(), [&](Key key, size_t) {
+            ++total;
+            if (!table.add(key)) pending.push_back(key);
+        });
+        addAll(pending, ThreadPool::shared());
+    }
+
+    // Counts every DNA/RNA sequence of the collection in parallel
+    void count(const vector<Sequence*>& seqs, ThreadPool& pool = ThreadPool::shared()) {
+        vector<const NucleotideSequence*> nuc;
+        for (const Sequence* s : seqs)
+            if (s->kind() != SequenceKind::Protein)
+                nuc.push_back(static_cast<const NucleotideSequence*>(s));
+
+        // Borrowed views are packed once, up front
+        vector<PackedBases> packedViews(nuc.size());
+        pool.parallelFor(nuc.size(), 16, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i)
+                if (nuc[i]->isView()) nuc[i]->packedBases(packedViews[i]);
+        });
+
+        vector<Segment> segs;
+        size_t roundSize = 0;
+        for (size_t i = 0; i < nuc.size(); ++i) {
+            const PackedBases* pb = nuc[i]->isView() ? &packedViews[i] : &nuc[i]->packed();
+            for (size_t from = 0; from < pb->size(); from += segmentBases) {
+                size_t to = min(pb->size(), from + segmentBases);
+                segs.push_back({ pb, from, to });
+                roundSize += to - from;
+                if (roundSize >= roundBases) {
+                    countSegments(segs, pool);
+                    segs.clear();
+                    roundSize = 0;
+                }
+            }
+        }
+        countSegments(segs, pool);
+    }
+
+    // Count of a k-mer given as text (its canonical form if counting canonically)
+    uint64_t get(string_view kmerText) const {
+        Key key;
+        if (kmerText.size() != k || !kmer::encode(kmerText, key)) return 0;
+        if (canonical) key = min(key, kmer::reverseComplement(key, k));
+        return table.get(key);
+    }
+
+    uint64_t totalKmers() const { return total; }
+    size_t distinct() const { return table.size(); }
+    size_t memoryUsage() const { return table.memoryUsage(); }
+    const KmerTable<Key>& counts() const { return table; }
+
+    // The n most frequent k-mers, most frequent first (ties by k-mer)
+    vector<pair<string, uint64_t>> top(size_t n) const {
+        vector<pair<uint64_t, Key>> heap;      // min-heap on count
+        auto cmp = [](const pair<uint64_t, Key>& a, const pair<uint64_t, Key>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        };
+        if (n == 0) return {};
+        table.forEach([&](Key key, uint64_t c) {
+            if (heap.size() < n) {
+                heap.emplace_back(c, key);
+                push_heap(heap.begin(), heap.end(), cmp);
+            } else if (cmp(make_pair(c, key), heap.front())) {
+                pop_heap(heap.begin(), heap.end(), cmp);
+                heap.back() = make_pair(c, key);
+                push_heap(heap.begin(), heap.end(), cmp);
+            }
+        });
+        sort(heap.begin(), heap.end(), cmp);
+        vector<pair<string, uint64_t>> out;
+        out.reserve(heap.size());
+        for (const auto& e : heap) out.emplace_back(kmer::decode(e.second, k), e.first);
+        return out;
+    }
+
+    // h[c] = number of distinct k-mers seen c times; h[maxCount] gathers the rest
+    vector<uint64_t> histogram(size_t maxCount = 255) const {
+        vector<uint64_t> h(maxCount + 1);
+        table.forEach([&](Key, uint64_t c) { ++h[min<uint64_t>(c, maxCount)]; });
+        return h;
+    }
+};
+
+using KmerCounter32 = KmerCounter<kmer::Key64>;
+using KmerCounter64 = KmerCounter<kmer::Key128>;
+
+/* ============================================================
+   CompositionStats: composition over a reference or annotation
+   Chromosomes are cut into blocks counted on the pool and then
+   reduced in order, adding the CpG pairs that straddle blocks.
+   ============================================================ */
+class CompositionStats {
+private:
+    static bool isC(char b) { return (b | 0x20) == 'c'; }
+    static bool isG(char b) { return (b | 0x20) == 'g'; }
+
+public:
+    static constexpr size_t blockBases = size_t(1) << 22;
+
+    // One Composition per .fai entry, in index order
+    static vector<Composition> perChromosome(const ReferenceStore& ref,
+                                             ThreadPool& pool = ThreadPool::shared()) {
+        struct Block { size_t chrom; size_t from; size_t to; };
+        const vector<ReferenceStore::FaiEntry>& idx = ref.index();
+        vector<Block> blocks;
+        for (size_t c = 0; c < idx.size(); ++c)
+            for (size_t from = 0; from < idx[c].length; from += blockBases)
+                blocks.push_back({ c, from, min(idx[c].length, from + blockBases) });
+
+        vector<Composition> partial(blocks.size());
+        pool.parallelFor(blocks.size(), 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                RefView v = ref.view(idx[blocks[i].chrom].name, blocks[i].from, blocks[i].to);
+                bool prevC = false;
+                v.forEachChunk([&](const char* p, size_t n) { stats::countText(p, n, partial[i], prevC); });
+            }
+        });
+
+        vector<Composition> out(idx.size());
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            out[blocks[i].chrom] += partial[i];
+            if (i > 0 && blocks[i - 1].chrom == blocks[i].chrom) {
+                const string& name = idx[blocks[i].chrom].name;
+                RefView pair = ref.view(name, blocks[i].from - 1, blocks[i].from + 1);
+                out[blocks[i].chrom].cpg += isC(pair.at(0)) && isG(pair.at(1));
+            }
+        }
+        return out;
+    }
+
+    // Forward-strand span of every gene, in annotation order
+    static vector<Composition> geneSpans(const GeneAnnotation& genes, const ReferenceStore& ref,
+                                         ThreadPool& pool = ThreadPool::shared()) {
+        vector<Composition> out(genes.size());
+        pool.parallelFor(genes.size(), 16, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                const Gene& g = genes[i];
+                RefView v = ref.view(g.getChrom(), size_t(g.getStart() - 1), size_t(g.getEnd()));
+                bool prevC = false;
+                v.forEachChunk([&](const char* p, size_t n) { stats::countText(p, n, out[i], prevC); });
+            }
+        });
+        return out;
+    }
+
+    // Every isoform of every gene, flattened in gene then isoform order
+    static vector<Composition> isoforms(const vector<Gene>& genes,
+                                        ThreadPool& pool = ThreadPool::shared()) {
+        vector<const Isoform*> all;
+        for (const Gene& g : genes)
+            for (const Isoform& iso : g.getIsoforms()) all.push_back(&iso);
+        vector<Composition> out(all.size());
+        pool.parallelFor(all.size(), 64, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) out[i] = all[i]->sequence().composition();
+        });
+        return out;
+    }
+};
+
+/* ============================================================
+   Pairwise alignment
+   ScoreMatrix maps residues to a small alphabet and scores
+   pairs. Gaps are affine: a gap of length L costs
+   gapOpen + (L - 1) * gapExtend.
+   ============================================================ */
+class ScoreMatrix {
+public:
+    static constexpr size_t MAX_ALPHABET = 32;
+
+private:
+    string alphabet;
+    array<uint8_t, 256> index;
+    array<int8_t, MAX_ALPHABET * MAX_ALPHABET> scores{};
+    int best = 0;
+    int worst = 0;
+
+    ScoreMatrix(string letters, char fallback) : alphabet(move(letters)) {
+        uint8_t unknown = uint8_t(alphabet.find(fallback));
+        index.fill(unknown);
+        for (size_t i = 0; i < alphabet.size(); ++i) {
+            index[static_cast<unsigned char>(alphabet[i])] = uint8_t(i);
+            index[static_cast<unsigned char>(tolower(alphabet[i]))] = uint8_t(i);
+        }
+    }
+
+    void finish() {
+        best = worst = scores[0];
+        for (size_t a = 0; a < alphabet.size(); ++a)
+            for (size_t b = 0; b < alphabet.size(); ++b) {
+                best = max(best, score(uint8_t(a), uint8_t(b)));
+                worst = min(worst, score(uint8_t(a), uint8_t(b)));
+            }
+    }
+
+public:
+    // A C G T (U) and N for anything else
+    static ScoreMatrix nucleotide(int match = 2, int mismatch = -3, int ambiguous = -1) {
+        ScoreMatrix m("ACGTN", 'N');
+        m.index['U'] = m.index['u'] = m.index['T'];
+        for (size_t a = 0; a < 5; ++a)
+            for (size_t b = 0; b < 5; ++b)
+                m.scores[a * MAX_ALPHABET + b] =
+                    int8_t(a == 4 || b == 4 ? ambiguous : a == b ? match : mismatch);
+        m.finish();
+        return m;
+    }
+
+    // NCBI BLOSUM62; letters outside the table score as X
+    static ScoreMatrix blosum62() {
+        static const int8_t table[24][24] = {
+            {  4, -1, -2, -2,  0, -1, -1,  0, -2, -1, -1, -1, -1, -2, -1,  1,  0, -3, -2,  0, -2, -1,  0, -4 },
+            { -1,  5,  0, -2, -3,  1,  0, -2,  0, -3, -2,  2, -1, -3, -2, -1, -1, -3, -2, -3, -1,  0, -1, -4 },
+            { -2,  0,  6,  1, -3,  0,  0,  0,  1, -3, -3,  0, -2, -3, -2,  1,  0, -4, -2, -3,  3,  0, -1, -4 },
+            { -2, -2,  1,  6, -3,  0,  2, -1, -1, -3, -4, -1, -3, -3, -1,  0, -1, -4, -3, -3,  4,  1, -1, -4 },
+            {  0, -3, -3, -3,  9, -3, -4, -3, -3, -1, -1, -3, -1, -2, -3, -1, -1, -2, -2, -1, -3, -3, -2, -4 },
+            { -1,  1,  0,  0, -3,  5,  2, -2,  0, -3, -2,  1,  0, -3, -1,  0, -1, -2, -1, -2,  0,  3, -1, -4 },
+            { -1,  0,  0,  2, -4,  2,  5, -2,  0, -3, -3,  1, -2, -3, -1,  0, -1, -3, -2, -2,  1,  4, -1, -4 },
+            {  0, -2,  0, -1, -3, -2, -2,  6, -2, -4, -4, -2, -3, -3, -2,  0, -2, -2, -3, -3, -1, -2, -1, -4 },
+            { -2,  0,  1, -1, -3,  0,  0, -2,  8, -3, -3, -1, -2, -1, -2, -1, -2, -2,  2, -3,  0,  0, -1, -4 },
+            { -1, -3, -3, -3, -1, -3, -3, -4, -3,  4,  2, -3,  1,  0, -3, -2, -1, -3, -1,  3, -3, -3, -1, -4 },
+            { -1, -2, -3, -4, -1, -2, -3, -4, -3,  2,  4, -2,  2,  0, -3, -2, -1, -2, -1,  1, -4, -3, -1, -4 },
+            { -1,  2,  0, -1, -3,  1,  1, -2, -1, -3, -2,  5, -1, -3, -1,  0, -1, -3, -2, -2,  0,  1, -1, -4 },
+            { -1, -1, -2, -3, -1,  0, -2, -3, -2,  1,  2, -1,  5,  0, -2, -1, -1, -1, -1,  1, -3, -1, -1, -4 },
+            { -2, -3, -3, -3, -2, -3, -3, -3, -1,  0,  0, -3,  0,  6, -4, -2, -2,  1,  3, -1, -3, -3, -1, -4 },
+            { -1, -2, -2, -1, -3, -1, -1, -2, -2, -3, -3, -1, -2, -4,  7, -1, -1, -4, -3, -2, -2, -1, -2, -4 },
+            {  1, -1,  1,  0, -1,  0,  0,  0, -1, -2, -2,  0, -1, -2, -1,  4,  1, -3, -2, -2,  0,  0,  0, -4 },
+            {  0, -1,  0, -1, -1, -1, -1, -2, -2, -1, -1, -1, -1, -2, -1,  1,  5, -2, -2,  0, -1, -1,  0, -4 },
+            { -3, -3, -4, -4, -2, -2, -3, -2, -2, -3, -2, -3, -1,  1, -4, -3, -2, 11,  2, -3, -4, -3, -2, -4 },
+            { -2, -2, -2, -3, -2, -1, -2, -3,  2, -1, -1, -2, -1,  3, -3, -2, -2,  2,  7, -1, -3, -2, -1, -4 },
+            {  0, -3, -3, -3, -1, -2, -2, -3, -3,  3,  1, -2,  1, -1, -2, -2,  0, -3, -1,  4, -3, -2, -1, -4 },
+            { -2, -1,  3,  4, -3,  0,  1, -1,  0, -3, -4,  0, -3, -3, -2,  0, -1, -4, -3, -3,  4,  1, -1, -4 },
+            { -1,  0,  0,  1, -3,  3,  4, -2,  0, -3, -3,  1, -1, -3, -1,  0, -1, -3, -2, -2,  1,  4, -1, -4 },
+            {  0, -1, -1, -1, -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -2,  0,  0, -2, -1, -1, -1, -1, -1, -4 },
+            { -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4,  1 },
+        };
+        ScoreMatrix m("ARNDCQEGHILKMFPSTWYVBZX*", 'X');
+        for (size_t a = 0; a < 24; ++a)
+            for (size_t b = 0; b < 24; ++b)
+                m.scores[a * MAX_ALPHABET + b] = table[a][b];
+        m.finish();
+        return m;
+    }
+
+    size_t size() const { return alphabet.size(); }
+    uint8_t encode(char c) const { return index[static_cast<unsigned char>(c)]; }
+    int score(uint8_t a, uint8_t b) const { return scores[a * MAX_ALPHABET + b]; }
+    int maxScore() const { return best; }
+    int minScore() const { return worst; }
+
+    vector<uint8_t> encode(string_view s) const {
+        vector<uint8_t> out(s.size());
+        for (size_t i = 0; i < s.size(); ++i) out[i] = encode(s[i]);
+        return out;
+    }
+};
+
+enum class AlignMode { Local, Global };
+
+struct Alignment {
+    int score = 0;
+    unsigned laneBits = 32;     // 8/16 = SIMD kernel used, 32 = scalar
+    // Filled when traceback was requested: 0-based, half-open
+    size_t queryBegin = 0, queryEnd = 0;
+    size_t targetBegin = 0, targetEnd = 0;
+    string cigar;               // M, I (query only), D (target only)
+};
+
+namespace align {
+
+constexpr int NEG_INF = INT32_MIN / 4;
+
+// Gotoh in 32-bit, score only, O(query) memory
+inline int scalarScore(const ScoreMatrix& sm, const vector<uint8_t>& q, const vector<uint8_t>& t,
+                       int open, int ext, AlignMode mode) {
+    size_t m = q.size(), n = t.size();
+    bool local = (mode == AlignMode::Local);
+    vector<int> H(m + 1), E(m + 1, NEG_INF);
+    for (size_t i = 1; i <= m; ++i) H[i] = local ? 0 : -open - int(i - 1) * ext;
+    int best = 0;
+    for (size_t j = 1; j <= n; ++j) {
+        int diag = H[0];
+        H[0] = local ? 0 : -open - int(j - 1) * ext;
+        int F = NEG_INF;
+        for (size_t i = 1; i <= m; ++i) {
+            E[i] = max(E[i] - ext, H[i] - open);
+            F = max(F - ext, H[i - 1] - open);
+            int h = max(diag + sm.score(q[i - 1], t[j - 1]), max(E[i], F));
+            if (local) h = max(h, 0);
+            diag = H[i];
+            H[i] = h;
+            best = max(best, h);
+        }
+    }
+    if (local) return best;
+    if (m == 0) return n ? -open - int(n - 1) * ext : 0;
+    return H[m];
+}
+
+/* Gotoh with a byte of traceback per cell:
+   bits 0-1 H from 0 (local start), 1 diagonal, 2 E (left), 3 F (up);
+   bit 2 E extends E, bit 3 F extends F. */
+inline Alignment scalarTraceback(const ScoreMatrix& sm, const vector<uint8_t>& q,
+                                 const vector<uint8_t>& t, int open, int ext, AlignMode mode) {
+    size_t m = q.size(), n = t.size();
+    bool local = (mode == AlignMode::Local);
+    vector<uint8_t> tb((m + 1) * (n + 1), 0);
+    vector<int> H(m + 1), E(m + 1, NEG_INF);
+    for (size_t i = 1; i <= m; ++i) {
+        H[i] = local ? 0 : -open - int(i - 1) * ext;
+        tb[i * (n + 1)] = local ? 0 : (3 | (i > 1 ? 8 : 0));
+    }
+    for (size_t j = 1; j <= n; ++j) tb[j] = local ? 0 : (2 | (j > 1 ? 4 : 0));
+
+    int best = 0;
+    size_t bi = 0, bj = 0;
+    for (size_t j = 1; j <= n; ++j) {
+        int diag = H[0];
+        H[0] = local ? 0 : -open - int(j - 1) * ext;
+        int F = NEG_INF;
+        for (size_t i = 1; i <= m; ++i) {
+            uint8_t bits = 0;
+            int eOpen = H[i] - open, eExt = E[i] - ext;
+            if (eExt > eOpen) bits |= 4;
+            E[i] = max(eOpen, eExt);
+            int fOpen = H[i - 1] - open, fExt = F - ext;
+            if (fExt > fOpen) bits |= 8;
+            F = max(fOpen, fExt);
+
+            int h = diag + sm.score(q[i - 1], t[j - 1]);
+            uint8_t from = 1;
+            if (E[i] > h) { h = E[i]; from = 2; }
+            if (F > h) { h = F; from = 3; }
+            if (local && h <= 0) { h = 0; from = 0; }
+            tb[i * (n + 1) + j] = bits | from;
+            diag = H[i];
+            H[i] = h;
+            if (local && h > best) { best = h; bi = i; bj = j; }
+        }
+    }
+
+    Alignment a;
+    if (local) {
+        a.score = best;
+    } else {
+        a.score = (m == 0) ? (n ? -open - int(n - 1) * ext : 0) : H[m];
+        bi = m;
+        bj = n;
+    }
+    a.queryEnd = bi;
+    a.targetEnd = bj;
+
+    // Walk back, collecting operations in reverse
+    string ops;
+    size_t i = bi, j = bj;
+    int state = 0;      // 0 H, 2 E, 3 F
+    while (i > 0 || j > 0) {
+        uint8_t c = tb[i * (n + 1) + j];
+        if (state == 0) {
+            uint8_t from = c & 3;
+            if (from == 0) break;
+            if (from == 1) { ops.push_back('M'); --i; --j; continue; }
+            state = from;
+        }
+        if (state == 2) {
+            ops.push_back('D');
+            state = (c & 4) ? 2 : 0;
+            --j;
+        } else {
+            ops.push_back('I');
+            state = (c & 8) ? 3 : 0;
+            --i;
+        }
+    }
+    a.queryBegin = i;
+    a.targetBegin = j;
+
+    for (size_t k = ops.size(); k > 0; ) {
+        char op = ops[k - 1];
+        size_t run = 0;
+        while (k > 0 && ops[k - 1] == op) { --k; ++run; }
+        a.cigar += to_string(run);
+        a.cigar += op;
+    }
+    return a;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// AVX2 lane operations for the striped kernel
+template <typename T> struct Lanes;
+
+template <> struct Lanes<int8_t> {
+    static constexpr size_t N = 32;
+    __attribute__((target("avx2"))) static __m256i load(const int8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    __attribute__((target("avx2"))) static void store(int8_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    __attribute__((target("avx2"))) static __m256i set1(int x) { return _mm256_set1_epi8(char(x)); }
+    __attribute__((target("avx2"))) static __m256i adds(__m256i a, __m256i b) { return _mm256_adds_epi8(a, b); }
+    __attribute__((target("avx2"))) static __m256i subs(__m256i a, __m256i b) { return _mm256_subs_epi8(a, b); }
+    __attribute__((target("avx2"))) static __m256i max(__m256i a, __m256i b) { return _mm256_max_epi8(a, b); }
+    __attribute__((target("avx2"))) static __m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi8(a, b); }
+    // Lane k takes lane k-1; lane 0 becomes 0
+    __attribute__((target("avx2"))) static __m256i shift(__m256i v) {
+        return _mm256_alignr_epi8(v, _mm256_permute2x128_si256(v, v, 0x08), 15);
+    }
+    __attribute__((target("avx2"))) static __m256i lane0(int x) {
+        return _mm256_setr_epi8(char(x), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+};
+
+template <> struct Lanes<int16_t> {
+    static constexpr size_t N = 16;
+    __attribute__((target("avx2"))) static __m256i load(const int16_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    __attribute__((target("avx2"))) static void store(int16_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    __attribute__((target("avx2"))) static __m256i set1(int x) { return _mm256_set1_epi16(short(x)); }
+    __attribute__((target("avx2"))) static __m256i adds(__m256i a, __m256i b) { return _mm256_adds_epi16(a, b); }
+    __attribute__((target("avx2"))) static __m256i subs(__m256i a, __m256i b) { return _mm256_subs_epi16(a, b); }
+    __attribute__((target("avx2"))) static __m256i max(__m256i a, __m256i b) { return _mm256_max_epi16(a, b); }
+    __attribute__((target("avx2"))) static __m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi16(a, b); }
+    __attribute__((target("avx2"))) static __m256i shift(__m256i v) {
+        return _mm256_alignr_epi8(v, _mm256_permute2x128_si256(v, v, 0x08), 14);
+    }
+    __attribute__((target("avx2"))) static __m256i lane0(int x) {
+        return _mm256_setr_epi16(short(x), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+};
+
+/* Striped query profile (Farrar): lane l of segment s holds query
+   position l * segLen + s, so the vertical dependency only crosses
+   lanes once per column. prof[(c * segLen + s) * N + l] is the
+   score of that position against residue c; padding scores the
+   lane minimum so it can never raise a maximum. */
+template <typename T>
+struct StripedProfile {
+    size_t segLen = 0;
+    vector<T> prof;
+
+    StripedProfile() = default;
+    StripedProfile(const ScoreMatrix& sm, const vector<uint8_t>& q) {
+        constexpr size_t N = Lanes<T>::N;
+        segLen = (q.size() + N - 1) / N;
+        prof.assign(sm.size() * segLen * N, numeric_limits<T>::min());
+        for (size_t c = 0; c < sm.size(); ++c)
+            for (size_t s = 0; s < segLen; ++s)
+                for (size_t l = 0; l < N; ++l) {
+                    size_t i = l * segLen + s;
+                    if (i < q.size())
+                        prof[(c * segLen + s) * N + l] = T(sm.score(q[i], uint8_t(c)));
+                }
+    }
+};
+
+/* Striped Smith-Waterman / Needleman-Wunsch with saturating lanes.
+   Returns false when a lane saturated and a wider kernel is needed. */
+template <typename T>
+__attribute__((target("avx2")))
+bool stripedScore(const StripedProfile<T>& sp, size_t m, const vector<uint8_t>& t,
+                  int open, int ext, AlignMode mode, int& score) {
+    using L = Lanes<T>;
+    constexpr size_t N = L::N;
+    const T lo = numeric_limits<T>::min(), hi = numeric_limits<T>::max();
+    const bool local = (mode == AlignMode::Local);
+    const size_t segLen = sp.segLen;
+
+    vector<T> Hs(segLen * N), Hl(segLen * N), Ev(segLen * N, lo);
+    T* hStore = Hs.data();
+    T* hLoad = Hl.data();
+    const __m256i vOpen = L::set1(open), vExt = L::set1(ext);
+    const __m256i vNeg = L::set1(lo), vZero = _mm256_setzero_si256();
+    const __m256i neg0 = L::lane0(lo);
+    __m256i vMax = vZero;
+
+    // Column 0: H[i][0] = 0 (local) or -open - i * ext
+    for (size_t s = 0; s < segLen; ++s)
+        for (size_t l = 0; l < N; ++l) {
+            long v = local ? 0 : -long(open) - long(l * segLen + s) * ext;
+            hStore[s * N + l] = T(std::max<long>(v, lo));
+        }
+
+    for (size_t j = 0; j < t.size(); ++j) {
+        const T* prof = sp.prof.data() + t[j] * segLen * N;
+        // Row 0 boundary: diagonal H[0][j] and the gap opening down from H[0][j+1]
+        long rowDiag = local ? 0 : (j == 0 ? 0 : -long(open) - long(j - 1) * ext);
+        long rowF = local ? lo : -2L * open - long(j) * ext;
+        __m256i vH = _mm256_or_si256(L::shift(L::load(hStore + (segLen - 1) * N)),
+                                     L::lane0(int(std::max<long>(rowDiag, lo))));
+        __m256i vF = _mm256_blendv_epi8(vNeg, L::lane0(int(std::max<long>(rowF, lo))), L::lane0(-1));
+        swap(hLoad, hStore);
+
+        for (size_t s = 0; s < segLen; ++s) {
+            vH = L::adds(vH, L::load(prof + s * N));
+            __m256i vE = L::load(Ev.data() + s * N);
+            vH = L::max(vH, vE);
+            vH = L::max(vH, vF);
+            if (local) vH = L::max(vH, vZero);
+            vMax = L::max(vMax, vH);
+            L::store(hStore + s * N, vH);
+            __m256i vHo = L::subs(vH, vOpen);
+            L::store(Ev.data() + s * N, L::max(L::subs(vE, vExt), vHo));
+            vF = L::max(L::subs(vF, vExt), vHo);
+            vH = L::load(hLoad + s * N);
+        }
+
+        // Lazy F: carry F across lanes until it can no longer raise H
+        for (size_t k = 0; k < N; ++k) {
+            vF = _mm256_or_si256(L::shift(vF), neg0);
+            bool more = true;
+            for (size_t s = 0; s < segLen && more; ++s) {
+                // Compare against the H the first pass opened F from, so
+                // equal open and extend penalties still propagate
+                __m256i vOld = L::load(hStore + s * N);
+                vH = L::max(vOld, vF);
+                L::store(hStore + s * N, vH);
+                vMax = L::max(vMax, vH);
+                L::store(Ev.data() + s * N, L::max(L::load(Ev.data() + s * N), L::subs(vH, vOpen)));
+                vF = L::subs(vF, vExt);
+                more = _mm256_movemask_epi8(L::gt(vF, L::subs(vOld, vOpen))) != 0;
+            }
+            if (!more) break;
+        }
+    }
+
+    if (local) {
+        alignas(32) T v[N];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(v), vMax);
+        int best = 0;
+        for (size_t l = 0; l < N; ++l) best = std::max<int>(best, v[l]);
+        score = best;
+        return best < hi;
+    }
+    if (m == 0) return false;
+    score = hStore[((m - 1) % segLen) * N + (m - 1) / segLen];
+    return score > lo && score < hi;
+}
+
+#endif
+
+}  // namespace align
+
+/* ============================================================
+   Aligner: local (Smith-Waterman) or global (Needleman-Wunsch)
+   alignment with affine gaps. Scores come from the striped AVX2
+   kernel in 8-bit lanes (local), then 16-bit, then 32-bit scalar
+   when a narrower lane saturates; global alignment starts at 16
+   bits when its score bound fits. Traceback (coordinates and a
+   CIGAR) uses the scalar kernel and O(query * target) bytes.
+   ============================================================ */
+class Aligner {
+private:
+    ScoreMatrix matrix;
+    int gapOpen;
+    int gapExtend;
+    AlignMode mode;
+
+    struct Query {
+        vector<uint8_t> codes;
+#if defined(__x86_64__) || defined(__i386__)
+        align::StripedProfile<int8_t> p8;
+        align::StripedProfile<int16_t> p16;
+#endif
+    };
+
+    static bool simd() {
+        return validation::activeKernel() == validation::Kernel::AVX2;
+    }
+
+    Query prepare(string_view q) const {
+        Query p;
+        p.codes = matrix.encode(q);
+#if defined(__x86_64__) || defined(__i386__)
+        if (simd() && !p.codes.empty()) {
+            if (mode == AlignMode::Local) p.p8 = align::StripedProfile<int8_t>(matrix, p.codes);
+            p.p16 = align::StripedProfile<int16_t>(matrix, p.codes);
+        }
+#endif
+        return p;
+    }
+
+    // Largest |cell| a global alignment can reach, for the 16-bit check
+    long globalBound(size_t m, size_t n) const {
+        long step = max<long>({ long(gapExtend), long(matrix.maxScore()), long(-matrix.minScore()) });
+        return 3L * gapOpen + long(m + n) * step;
+    }
+
+    Alignment alignPrepared(const Query& q, string_view target, bool traceback) const {
+        vector<uint8_t> t = matrix.encode(target);
+        if (traceback)
+            return align::scalarTraceback(matrix, q.codes, t, gapOpen, gapExtend, mode);
+
+        Alignment a;
+#if defined(__x86_64__) || defined(__i386__)
+        if (simd() && !q.codes.empty() && !t.empty()) {
+            size_t m = q.codes.size();
+            if (mode == AlignMode::Local) {
+                a.laneBits = 8;
+                if (align::stripedScore(q.p8, m, t, gapOpen, gapExtend, mode, a.score)) return a;
+                a.laneBits = 16;
+                if (align::stripedScore(q.p16, m, t, gapOpen, gapExtend, mode, a.score)) return a;
+            } else if (globalBound(m, t.size()) < 30000) {
+                a.laneBits = 16;
+                if (align::stripedScore(q.p16, m, t, gapOpen, gapExtend, mode, a.score)) return a;
+            }
+        }
+#endif
+        a.laneBits = 32;
+        a.score = align::scalarScore(matrix, q.codes, t, gapOpen, gapExtend, mode);
+        return a;
+    }
+
+    static string textOf(const Sequence& s) {
+        if (s.kind() == SequenceKind::Protein)
+            return string(static_cast<const ProteinSequence&>(s).residues());
+        return static_cast<const NucleotideSequence&>(s).str();
+    }
+
+public:
+    Aligner(ScoreMatrix m, int open, int extend, AlignMode md = AlignMode::Local)
+        : matrix(move(m)), gapOpen(open), gapExtend(extend), mode(md) {
+        if (open < extend || extend < 1 || open > 127)
+            throw invalid_argument("Aligner: need 1 <= gapExtend <= gapOpen <= 127");
+    }
+
+    // BLOSUM62 with gaps 11/1 for proteins, +2/-3 with gaps 5/2 for DNA/RNA
+    static Aligner forKind(SequenceKind k, AlignMode md = AlignMode::Local) {
+        if (k == SequenceKind::Protein) return Aligner(ScoreMatrix::blosum62(), 11, 1, md);
+        return Aligner(ScoreMatrix::nucleotide(), 5, 2, md);
+    }
+
+    AlignMode alignMode() const { return mode; }
+    const ScoreMatrix& scoreMatrix() const { return matrix; }
+
+    Alignment align(string_view query, string_view target, bool traceback = false) const {
+        return alignPrepared(prepare(query), target, traceback);
+    }
+
+    Alignment align(const Sequence& query, const Sequence& target, bool traceback = false) const {
+        if ((query.kind() == SequenceKind::Protein) != (target.kind() == SequenceKind::Protein))
+            throw invalid_argument("Aligner: cannot align protein against nucleotides");
+        return align(textOf(query), textOf(target), traceback);
+    }
+
+    // One query against many targets: the profile is built once, targets run on the pool
+    vector<Alignment> alignMany(const Sequence& query, const vector<Sequence*>& targets,
+                                bool traceback = false,
+                                ThreadPool& pool = ThreadPool::shared()) const {
+        bool protein = query.kind() == SequenceKind::Protein;
+        for (const Sequence* t : targets)
+            if ((t->kind() == SequenceKind::Protein) != protein)
+                throw invalid_argument("Aligner: cannot align protein against nucleotides");
+        Query q = prepare(textOf(query));
+        vector<Alignment> out(targets.size());
+        pool.parallelFor(targets.size(), 4, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i)
+                out[i] = alignPrepared(q, textOf(*targets[i]), traceback);
+        });
+        return out;
+    }
+};
+
+/* ============================================================
+   AnnotationSnapshot: columnar binary image of genes, isoforms
+   and isoform sequences, read through mmap without parsing.
+
+   Layout (little-endian, sections 8-byte aligned):
+     Header   magic, version, counts, {offset, size} per section
+     STRINGS  string pool; every id/name/chrom is stored once
+     CHROMS, GENE_IDS, GENE_NAMES, ISO_IDS, ISO_NAMES
+              StrRef {offset, length} into the pool
+     GENE_CHROM (uint32), GENE_STRAND (char), GENE_ISOFORMS
+              (uint32 prefix offsets, genes + 1 entries)
+     START_DELTAS  zigzag varints of start[i] - start[i-1]
+     LENGTHS       varints of end - start
+     CHECKPOINTS   absolute start and stream offsets every 64
+                   genes, so a gene decodes at most 63 varints
+     ISO_SEQ  StoredSeq per isoform: length and offsets into
+     WORDS    PackedBases words, RUNS (ambiguity), SPANS (mask)
+   ============================================================ */
+class AnnotationSnapshot {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t CHECKPOINT_EVERY = 64;
+
+    struct GeneRecord {
+        string_view id;
+        string_view name;
+        string_view chrom;
+        uint32_t chromId;
+        int start;
+        int end;
+        char strand;
+        size_t firstIsoform;
+        size_t isoformEnd;
+    };
+
+    struct IsoformRecord {
+        string_view id;
+        string_view name;
+        size_t length;
+    };
+
+private:
+    enum Section : uint32_t {
+        STRINGS, CHROMS, GENE_IDS, GENE_NAMES, GENE_CHROM, GENE_STRAND, GENE_ISOFORMS,
+        START_DELTAS, LENGTHS, CHECKPOINTS, ISO_IDS, ISO_NAMES, ISO_SEQ, WORDS, RUNS, SPANS,
+        SECTION_COUNT
+    };
+
+    struct SectionRef { uint64_t offset; uint64_t size; };
+    struct StrRef { uint32_t offset; uint32_t len; };
+    struct Checkpoint { int64_t start; uint64_t deltaByte; uint64_t lengthByte; };
+    struct StoredSeq { uint64_t length; uint64_t word; uint32_t run; uint32_t runs; uint32_t span; uint32_t spans; };
+    struct StoredRun { uint64_t start; uint64_t len; uint64_t base; };
+    struct StoredSpan { uint64_t start; uint64_t len; };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;     // 0x01020304 as written
+        uint64_t chroms;
+        uint64_t genes;
+        uint64_t isoforms;
+        SectionRef sections[SECTION_COUNT];
+    };
+
+    static constexpr char MAGIC[8] = { 'L', 'A', 'B', '5', 'S', 'N', 'A', 'P' };
+
+    int fd = -1;
+    const char* map = nullptr;
+    size_t mapSize = 0;
+    const Header* header = nullptr;
+
+    template <typename T>
+    const T* column(Section s) const {
+        return reinterpret_cast<const T*>(map + header->sections[s].offset);
+    }
+
+    template <typename T>
+    uint64_t entries(Section s) const { return header->sections[s].size / sizeof(T); }
+
+    template <typename T>
+    const T* columnEnd(Section s) const { return column<T>(s) + entries<T>(s); }
+
+    /* validate() only checks section sizes, so indices stored inside
+       sections are checked where they are followed; a corrupt or
+       hand-edited file throws instead of reading outside the map */
+    [[noreturn]] static void corrupt(const char* what) {
+        throw runtime_error(string("AnnotationSnapshot: corrupt snapshot: ") + what);
+    }
+
+    string_view str(StrRef r) const {
+        if (uint64_t(r.offset) + r.len > header->sections[STRINGS].size) corrupt("string outside the pool");
+        return string_view(column<char>(STRINGS) + r.offset, r.len);
+    }
+
+    uint32_t chromOf(size_t gene) const {
+        uint32_t c = column<uint32_t>(GENE_CHROM)[gene];
+        if (c >= header->chroms) corrupt("chromosome index out of range");
+        return c;
+    }
+
+    pair<size_t, size_t> isoformsOf(size_t gene) const {
+        const uint32_t* iso = column<uint32_t>(GENE_ISOFORMS);
+        if (iso[gene] > iso[gene + 1] || iso[gene + 1] > header->isoforms) corrupt("isoform range out of order");
+        return { iso[gene], iso[gene + 1] };
+    }
+
+    static void putVarint(vector<uint8_t>& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    static uint64_t getVarint(const uint8_t*& p, const uint8_t* end) {
+        uint64_t v = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            if (p == end || shift > 63) corrupt("truncated varint stream");
+            uint8_t b = *p++;
+            v |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+    }
+
+    static uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+    static int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+    // Checks that the sections fit the file and match the counts
+    void validate(const string& path) const {
+        auto fail = [&path](const string& why) {
+            throw runtime_error("AnnotationSnapshot: " + path + ": " + why);
+        };
+        if (mapSize < sizeof(Header) || memcmp(header->magic, MAGIC, 8) != 0) fail("not a snapshot");
+        if (header->byteOrder != 0x01020304) fail("written with a different byte order");
+        if (header->version != VERSION) fail("unsupported version " + to_string(header->version));
+        for (const SectionRef& s : header->sections)
+            if (s.offset % 8 || s.offset > mapSize || s.size > mapSize - s.offset) fail("section out of range");
+
+        uint64_t g = header->genes, iso = header->isoforms;
+        auto expect = [&](Section s, uint64_t bytes) {
+            if (header->sections[s].size != bytes) fail("section size mismatch");
+        };
+        expect(CHROMS, header->chroms * sizeof(StrRef));
+        expect(GENE_IDS, g * sizeof(StrRef));
+        expect(GENE_NAMES, g * sizeof(StrRef));
+        expect(GENE_CHROM, g * sizeof(uint32_t));
+        expect(GENE_STRAND, g);
+        expect(GENE_ISOFORMS, (g + 1) * sizeof(uint32_t));
+        expect(CHECKPOINTS, (g + CHECKPOINT_EVERY - 1) / CHECKPOINT_EVERY * sizeof(Checkpoint));
+        expect(ISO_IDS, iso * sizeof(StrRef));
+        expect(ISO_NAMES, iso * sizeof(StrRef));
+        expect(ISO_SEQ, iso * sizeof(StoredSeq));
+        if (g && column<uint32_t>(GENE_ISOFORMS)[g] != iso) fail("isoform count mismatch");
+    }
+
+public:
+    // Writes genes (and their isoforms' sequences) to path
+    static void write(const string& path, const vector<Gene>& genes) {
+        vector<char> pool;
+        unordered_map<Symbol, StrRef> pooled;
+        auto poolRef = [&](Symbol sym) {
+            auto it = pooled.find(sym);
+            if (it != pooled.end()) return it->second;
+            const string& s = sym.str();
+            StrRef r{ uint32_t(pool.size()), uint32_t(s.size()) };
+            pool.insert(pool.end(), s.begin(), s.end());
+            pooled.emplace(sym, r);
+            return r;
+        };
+
+        vector<StrRef> chroms, geneIds, geneNames, isoIds, isoNames;
+        unordered_map<Symbol, uint32_t> chromIndex;
+        vector<uint32_t> geneChrom, geneIsoforms{ 0 };
+        vector<char> strands;
+        vector<uint8_t> deltas, lengths;
+        vector<Checkpoint> checkpoints;
+        vector<StoredSeq> seqs;
+        vector<uint64_t> words;
+        vector<StoredRun> runs;
+        vector<StoredSpan> spans;
+
+        int64_t prevStart = 0;
+        for (size_t i = 0; i < genes.size(); ++i) {
+            const Gene& g = genes[i];
+            auto c = chromIndex.emplace(g.chromSymbol(), uint32_t(chroms.size()));
+            if (c.second) chroms.push_back(poolRef(g.chromSymbol()));
+            geneChrom.push_back(c.first->second);
+            geneIds.push_back(poolRef(g.idSymbol()));
+            geneNames.push_back(poolRef(g.nameSymbol()));
+            strands.push_back(g.getStrand());
+
+            if (i % CHECKPOINT_EVERY == 0)
+                checkpoints.push_back({ g.getStart(), deltas.size(), lengths.size() });
+            putVarint(deltas, zigzag(int64_t(g.getStart()) - prevStart));
+            putVarint(lengths, zigzag(int64_t(g.getEnd()) - g.getStart()));
+            prevStart = g.getStart();
+
+            for (const Isoform& iso : g.getIsoforms()) {
+                isoIds.push_back(poolRef(iso.idSymbol()));
+                isoNames.push_back(poolRef(iso.nameSymbol()));
+                PackedBases scratch;
+                const PackedBases& pb = iso.sequence().packedBases(scratch);
+                seqs.push_back({ pb.size(), words.size(), uint32_t(runs.size()),
+                                 uint32_t(pb.ambiguityRuns().size()), uint32_t(spans.size()),
+                                 uint32_t(pb.maskRuns().size()) });
+                words.insert(words.end(), pb.packedWords().begin(), pb.packedWords().end());
+                for (const PackedBases::Run& r : pb.ambiguityRuns())
+                    runs.push_back({ r.start, r.len, uint64_t(static_cast<unsigned char>(r.base)) });
+                for (const PackedBases::Span& s : pb.maskRuns())
+                    spans.push_back({ s.start, s.len });
+            }
+            geneIsoforms.push_back(uint32_t(isoIds.size()));
+        }
+        if (pool.size() > UINT32_MAX) throw length_error("AnnotationSnapshot: string pool over 4 GiB");
+
+        Header h{};
+        memcpy(h.magic, MAGIC, 8);
+        h.version = VERSION;
+        h.byteOrder = 0x01020304;
+        h.chroms = chroms.size();
+        h.genes = genes.size();
+        h.isoforms = isoIds.size();
+
+        const pair<const void*, size_t> data[SECTION_COUNT] = {
+            { pool.data(), pool.size() },
+            { chroms.data(), chroms.size() * sizeof(StrRef) },
+            { geneIds.data(), geneIds.size() * sizeof(StrRef) },
+            { geneNames.data(), geneNames.size() * sizeof(StrRef) },
+            { geneChrom.data(), geneChrom.size() * sizeof(uint32_t) },
+            { strands.data(), strands.size() },
+            { geneIsoforms.data(), geneIsoforms.size() * sizeof(uint32_t) },
+            { deltas.data(), deltas.size() },
+            { lengths.data(), lengths.size() },
+            { checkpoints.data(), checkpoints.size() * sizeof(Checkpoint) },
+            { isoIds.data(), isoIds.size() * sizeof(StrRef) },
+            { isoNames.data(), isoNames.size() * sizeof(StrRef) },
+            { seqs.data(), seqs.size() * sizeof(StoredSeq) },
+            { words.data(), words.size() * sizeof(uint64_t) },
+            { runs.data(), runs.size() * sizeof(StoredRun) },
+            { spans.data(), spans.size() * sizeof(StoredSpan) },
+        };
+        uint64_t offset = (sizeof(Header) + 7) & ~uint64_t(7);
+        for (size_t s = 0; s < SECTION_COUNT; ++s) {
+            h.sections[s] = { offset, data[s].second };
+            offset = (offset + data[s].second + 7) & ~uint64_t(7);
+        }
+
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("AnnotationSnapshot: cannot create " + path);
+        const char zeros[8] = {};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(zeros, h.sections[0].offset - sizeof(h));
+        for (size_t s = 0; s < SECTION_COUNT; ++s) {
+            if (data[s].second) out.write(static_cast<const char*>(data[s].first), data[s].second);
+            out.write(zeros, (8 - data[s].second % 8) % 8);
+        }
+        if (!out) throw runtime_error("AnnotationSnapshot: write failed for " + path);
+    }
+
+    static void write(const string& path, const GeneAnnotation& annotation) {
+        write(path, annotation.all());
+    }
+
+    // Maps the file and checks its header; nothing is decoded up front
+    explicit AnnotationSnapshot(const string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("AnnotationSnapshot: cannot open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); throw runtime_error("AnnotationSnapshot: cannot stat " + path); }
+        mapSize = static_cast<size_t>(st.st_size);
+        if (mapSize < sizeof(Header)) { ::close(fd); throw runtime_error("AnnotationSnapshot: " + path + ": not a snapshot"); }
+
+        void* m = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) { ::close(fd); throw runtime_error("AnnotationSnapshot: cannot mmap " + path); }
+        map = static_cast<const char*>(m);
+        header = reinterpret_cast<const Header*>(map);
+
+        try {
+            validate(path);
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    AnnotationSnapshot(const AnnotationSnapshot&) = delete;
+    AnnotationSnapshot& operator=(const AnnotationSnapshot&) = delete;
+
+    ~AnnotationSnapshot() {
+        release();
+    }
+
+    void release() {
+        if (map) munmap(const_cast<char*>(map), mapSize);
+        if (fd >= 0) ::close(fd);
+        map = nullptr;
+        header = nullptr;
+        fd = -1;
+    }
+
+    size_t chromCount() const { return header->chroms; }
+    size_t geneCount() const { return header->genes; }
+    size_t isoformCount() const { return header->isoforms; }
+    string_view chromName(uint32_t c) const { return str(column<StrRef>(CHROMS)[c]); }
+
+    GeneRecord gene(size_t i) const {
+        const Checkpoint& cp = column<Checkpoint>(CHECKPOINTS)[i / CHECKPOINT_EVERY];
+        const uint8_t* dEnd = columnEnd<uint8_t>(START_DELTAS);
+        const uint8_t* lEnd = columnEnd<uint8_t>(LENGTHS);
+        if (cp.deltaByte > entries<uint8_t>(START_DELTAS) || cp.lengthByte > entries<uint8_t>(LENGTHS))
+            corrupt("checkpoint outside its stream");
+        const uint8_t* d = column<uint8_t>(START_DELTAS) + cp.deltaByte;
+        const uint8_t* l = column<uint8_t>(LENGTHS) + cp.lengthByte;
+        int64_t start = cp.start;
+        getVarint(d, dEnd);
+        for (size_t k = i / CHECKPOINT_EVERY * CHECKPOINT_EVERY; k < i; ++k) {
+            start += unzigzag(getVarint(d, dEnd));
+            getVarint(l, lEnd);
+        }
+        int64_t len = unzigzag(getVarint(l, lEnd));
+
+        uint32_t c = chromOf(i);
+        pair<size_t, size_t> iso = isoformsOf(i);
+        return GeneRecord{ str(column<StrRef>(GENE_IDS)[i]), str(column<StrRef>(GENE_NAMES)[i]),
+                           chromName(c), c, int(start), int(start + len),
+                           column<char>(GENE_STRAND)[i], iso.first, iso.second };
+    }
+
+    // Calls f(const GeneRecord&) for every gene, decoding the streams once
+    template <typename F>
+    void forEachGene(F f) const {
+        const uint8_t* d = column<uint8_t>(START_DELTAS);
+        const uint8_t* l = column<uint8_t>(LENGTHS);
+        const uint8_t* dEnd = columnEnd<uint8_t>(START_DELTAS);
+        const uint8_t* lEnd = columnEnd<uint8_t>(LENGTHS);
+        int64_t start = 0;
+        for (size_t i = 0; i < geneCount(); ++i) {
+            start += unzigzag(getVarint(d, dEnd));
+            int64_t len = unzigzag(getVarint(l, lEnd));
+            uint32_t c = chromOf(i);
+            pair<size_t, size_t> iso = isoformsOf(i);
+            f(GeneRecord{ str(column<StrRef>(GENE_IDS)[i]), str(column<StrRef>(GENE_NAMES)[i]),
+                          chromName(c), c, int(start), int(start + len),
+                          column<char>(GENE_STRAND)[i], iso.first, iso.second });
+        }
+    }
+
+    IsoformRecord isoform(size_t j) const {
+        return IsoformRecord{ str(column<StrRef>(ISO_IDS)[j]), str(column<StrRef>(ISO_NAMES)[j]),
+                              size_t(column<StoredSeq>(ISO_SEQ)[j].length) };
+    }
+
+    // Copies an isoform's packed words out of the map (no re-encoding)
+    RNASequence sequence(size_t j, const SeqAllocator& a = {}) const {
+        const StoredSeq& s = column<StoredSeq>(ISO_SEQ)[j];
+        uint64_t words = (s.length + 31) / 32;
+        if (s.length > entries<uint64_t>(WORDS) * 32 || s.word > entries<uint64_t>(WORDS) - words)
+            corrupt("sequence words out of range");
+        if (uint64_t(s.run) + s.runs > entries<StoredRun>(RUNS)) corrupt("ambiguity runs out of range");
+        if (uint64_t(s.span) + s.spans > entries<StoredSpan>(SPANS)) corrupt("mask spans out of range");
+
+        // Runs must be sorted, disjoint and inside the sequence
+        uint64_t prevEnd = 0;
+        auto checkRun = [&](uint64_t start, uint64_t len) {
+            if (start < prevEnd || len == 0 || len > s.length || start > s.length - len)
+                corrupt("run outside its sequence");
+            prevEnd = start + len;
+        };
+        vector<PackedBases::Run> runs;
+        vector<PackedBases::Span> spans;
+        const StoredRun* r = column<StoredRun>(RUNS) + s.run;
+        for (uint32_t k = 0; k < s.runs; ++k) {
+            checkRun(r[k].start, r[k].len);
+            runs.push_back({ size_t(r[k].start), size_t(r[k].len), char(r[k].base) });
+        }
+        prevEnd = 0;
+        const StoredSpan* m = column<StoredSpan>(SPANS) + s.span;
+        for (uint32_t k = 0; k < s.spans; ++k) {
+            checkRun(m[k].start, m[k].len);
+            spans.push_back({ size_t(m[k].start), size_t(m[k].len) });
+        }
+        return RNASequence(PackedBases(column<uint64_t>(WORDS) + s.word, size_t(s.length), 'U',
+                                       runs, spans, a));
+    }
+
+    Gene makeGene(size_t i, const SeqAllocator& a = {}) const {
+        GeneRecord r = gene(i);
+        Gene g(r.id, r.name, r.chrom, r.start, r.end, r.strand, a);
+        g.reserveIsoforms(r.isoformEnd - r.firstIsoform);
+        for (size_t j = r.firstIsoform; j < r.isoformEnd; ++j) {
+            IsoformRecord iso = isoform(j);
+            g.emplaceIsoform(iso.id, iso.name, sequence(j, a));
+        }
+        return g;
+    }
+
+    // Materializes every gene into an (unbuilt) annotation
+    GeneAnnotation load() const {
+        GeneAnnotation out;
+        out.reserve(geneCount());
+        for (size_t i = 0; i < geneCount(); ++i) out.add(makeGene(i));
+        return out;
+    }
+};
+
+/* ============================================================
+   FMIndex: exact search over one or more nucleotide sequences.
+   The suffix array comes from SA-IS; the BWT is stored as two
+   bit planes per 64-row block next to running A/C/G/T counts,
+   so a rank is one popcount. Rows whose text position is a
+   multiple of sampleRate keep their suffix array entry for
+   locate(). Sequences are joined with separators so hits never
+   span two of them; anything but A/C/G/T(U) in the text never
+   matches. Case is ignored. The same image is built in memory
+   or mapped from a file written by save().
+   ============================================================ */
+class FMIndex {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Hit {
+        uint32_t sequence;
+        size_t position;    // 0-based within that sequence
+
+        bool operator==(const Hit& o) const { return sequence == o.sequence && position == o.position; }
+        bool operator<(const Hit& o) const {
+            return sequence != o.sequence ? sequence < o.sequence : position < o.position;
+        }
+    };
+
+    // Suffix array rows [lo, hi) whose suffixes start with a pattern
+    struct Range {
+        size_t lo = 0;
+        size_t hi = 0;
+        size_t count() const { return hi - lo; }
+        bool empty() const { return hi <= lo; }
+    };
+
+private:
+    // Text codes in suffix order: sentinel < A < C < G < T < separator/N
+    enum Code : uint8_t { SENTINEL = 0, SEPARATOR = 5, CODES = 6 };
+
+    enum Section : uint32_t { BLOCKS, SAMPLED, SAMPLES, STARTS, NAME_REFS, NAMES, SECTION_COUNT };
+
+    struct SectionRef { uint64_t offset; uint64_t size; };
+    struct StrRef { uint64_t offset; uint64_t len; };
+
+    // 64 BWT rows: A/C/G/T code in two bit planes, separators and
+    // the sentinel flagged in special; counts are of earlier rows
+    struct Block {
+        uint32_t before[5];     // A, C, G, T, special
+        uint32_t pad;
+        uint64_t lo;
+        uint64_t hi;
+        uint64_t special;
+    };
+
+    struct SampleWord { uint64_t bits; uint64_t before; };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;     // 0x01020304 as written
+        uint64_t bytes;
+        uint64_t length;        // text length incl. separators and sentinel
+        uint64_t sampleRate;
+        uint64_t sentinelRow;
+        uint64_t sequences;
+        uint64_t C[CODES];
+        SectionRef sections[SECTION_COUNT];
+    };
+
+    static constexpr char MAGIC[8] = { 'L', 'A', 'B', '5', 'F', 'M', 'I', 'X' };
+
+    vector<uint64_t> image;     // owned image when built in memory
+    int fd = -1;
+    const char* map = nullptr;
+    size_t mapSize = 0;
+    const char* base = nullptr;
+    const Header* header = nullptr;
+
+    template <typename T>
+    const T* column(Section s) const {
+        return reinterpret_cast<const T*>(base + header->sections[s].offset);
+    }
+
+    static const array<uint8_t, 256>& codeTable() {
+        static const array<uint8_t, 256> table = [] {
+            array<uint8_t, 256> t;
+            t.fill(SEPARATOR);
+            const char* letters = "ACGT";
+            for (uint8_t c = 0; c < 4; ++c) {
+                t[static_cast<unsigned char>(letters[c])] = c + 1;
+                t[static_cast<unsigned char>(tolower(letters[c]))] = c + 1;
+            }
+            t['U'] = t['u'] = 4;
+            return t;
+        }();
+        return table;
+    }
+
+    /* SA-IS (Nong, Zhang and Chan): sorts the LMS substrings by
+       induced sorting, recurses on their names if any repeat, then
+       induces the full order from the sorted LMS suffixes.
+       T[n - 1] must be the unique smallest symbol. */
+    template <typename Char>
+    static void sais(const Char* T, uint32_t* SA, size_t n, size_t K) {
+        const uint32_t EMPTY = UINT32_MAX;
+        if (n == 1) { SA[0] = 0; return; }
+
+        vector<bool> stype(n);
+        stype[n - 1] = true;
+        for (size_t i = n - 1; i-- > 0; )
+            stype[i] = T[i] < T[i + 1] || (T[i] == T[i + 1] && stype[i + 1]);
+        auto isLMS = [&stype](size_t i) { return i > 0 && stype[i] && !stype[i - 1]; };
+
+        vector<uint32_t> counts(K, 0), bkt(K);
+        for (size_t i = 0; i < n; ++i) ++counts[T[i]];
+        auto heads = [&] {
+            uint32_t s = 0;
+            for (size_t c = 0; c < K; ++c) { bkt[c] = s; s += counts[c]; }
+        };
+        auto tails = [&] {
+            uint32_t s = 0;
+            for (size_t c = 0; c < K; ++c) { s += counts[c]; bkt[c] = s; }
+        };
+        auto induce = [&] {
+            heads();
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t j = SA[i];
+                if (j != EMPTY && j > 0 && !stype[j - 1]) SA[bkt[T[j - 1]]++] = j - 1;
+            }
+            tails();
+            for (size_t i = n; i-- > 0; ) {
+                uint32_t j = SA[i];
+                if (j != EMPTY && j > 0 && stype[j - 1]) SA[--bkt[T[j - 1]]] = j - 1;
+            }
+        };
+
+        // Sort the LMS substrings
+        fill(SA, SA + n, EMPTY);
+        tails();
+        for (size_t i = 1; i < n; ++i)
+            if (isLMS(i)) SA[--bkt[T[i]]] = uint32_t(i);
+        induce();
+
+        // Name them; equal substrings share a name
+        size_t n1 = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (isLMS(SA[i])) SA[n1++] = SA[i];
+        fill(SA + n1, SA + n, EMPTY);
+        uint32_t names = 0;
+        size_t prev = SIZE_MAX;
+        for (size_t i = 0; i < n1; ++i) {
+            size_t pos = SA[i];
+            bool diff = false;
+            for (size_t d = 0; ; ++d) {
+                if (prev == SIZE_MAX || T[pos + d] != T[prev + d] || stype[pos + d] != stype[prev + d]) {
+                    diff = true;
+                    break;
+                }
+                if (d > 0 && (isLMS(pos + d) || isLMS(prev + d))) break;
+            }
+            if (diff) { ++names; prev = pos; }
+            SA[n1 + pos / 2] = names - 1;
+        }
+        for (size_t i = n, j = n; i-- > n1; )
+            if (SA[i] != EMPTY) SA[--j] = SA[i];
+
+        // Order the LMS suffixes, recursing while names repeat
+        uint32_t* s1 = SA + n - n1;
+        if (names < n1)
+            sais(static_cast<const uint32_t*>(s1), SA, n1, names);
+        else
+            for (size_t i = 0; i < n1; ++i) SA[s1[i]] = uint32_t(i);
+
+        for (size_t i = 1, j = 0; i < n; ++i)
+            if (isLMS(i)) s1[j++] = uint32_t(i);
+        for (size_t i = 0; i < n1; ++i) SA[i] = s1[SA[i]];
+        fill(SA + n1, SA + n, EMPTY);
+        tails();
+        for (size_t i = n1; i-- > 0; ) {
+            uint32_t j = SA[i];
+            SA[i] = EMPTY;
+            SA[--bkt[T[j]]] = j;
+        }
+        induce();
+    }
+
+    // Occurrences of code c (0-3 = A/C/G/T) in BWT rows [0, row)
+    size_t rank(unsigned c, size_t row) const {
+        const Block& b = column<Block>(BLOCKS)[row >> 6];
+        uint64_t keep = (uint64_t(1) << (row & 63)) - 1;
+        uint64_t m = ((c & 1) ? b.lo : ~b.lo) & ((c & 2) ? b.hi : ~b.hi) & ~b.special;
+        return b.before[c] + size_t(__builtin_popcountll(m & keep));
+    }
+
+    // Row of the suffix one text position to the left
+    size_t lf(size_t row) const {
+        const Block& b = column<Block>(BLOCKS)[row >> 6];
+        uint64_t bit = uint64_t(1) << (row & 63);
+        if (b.special & bit) {
+            if (row == header->sentinelRow) return 0;
+            size_t separators = b.before[4] + size_t(__builtin_popcountll(b.special & (bit - 1)))
+                                - (header->sentinelRow < row);
+            return header->C[SEPARATOR] + separators;
+        }
+        unsigned c = unsigned((b.lo & bit) != 0) | (unsigned((b.hi & bit) != 0) << 1);
+        return header->C[c + 1] + rank(c, row);
+    }
+
+    // Suffix array entry of a row: walk LF to a sampled row
+    size_t textPosition(size_t row) const {
+        const SampleWord* words = column<SampleWord>(SAMPLED);
+        size_t steps = 0;
+        while (!((words[row >> 6].bits >> (row & 63)) & 1)) {
+            row = lf(row);
+            ++steps;
+        }
+        const SampleWord& w = words[row >> 6];
+        size_t k = w.before + size_t(__builtin_popcountll(w.bits & ((uint64_t(1) << (row & 63)) - 1)));
+        return (column<uint32_t>(SAMPLES)[k] + steps) % header->length;
+    }
+
+    Hit toHit(size_t pos) const {
+        const uint64_t* starts = column<uint64_t>(STARTS);
+        size_t k = size_t(upper_bound(starts, starts + header->sequences, uint64_t(pos)) - starts) - 1;
+        return Hit{ uint32_t(k), pos - starts[k] };
+    }
+
+    // Text codes of several sequences joined by separators, then the sentinel
+    template <typename F>
+    void build(size_t count, F forEachSequence, const vector<string>& names, uint32_t sampleRate) {
+        if (sampleRate == 0) throw invalid_argument("FMIndex: sample rate must be > 0");
+        const array<uint8_t, 256>& table = codeTable();
+        vector<uint8_t> text;
+        vector<uint64_t> starts;
+        forEachSequence([&](auto&& appendTo) {
+            if (!starts.empty()) text.push_back(SEPARATOR);
+            starts.push_back(text.size());
+            appendTo([&](const char* p, size_t len) {
+                for (size_t i = 0; i < len; ++i) text.push_back(table[static_cast<unsigned char>(p[i])]);
+            });
+        });
+        if (starts.size() != count) throw logic_error("FMIndex: sequence count mismatch");
+        if (starts.empty()) starts.push_back(0);
+        text.push_back(SENTINEL);
+        size_t n = text.size();
+        if (n >= UINT32_MAX) throw length_error("FMIndex: text over 4 Gbases");
+
+        vector<uint32_t> sa(n);
+        sais(text.data(), sa.data(), n, CODES);
+
+        // Lay out the image
+        string pool;
+        vector<StrRef> refs;
+        for (size_t k = 0; k < starts.size(); ++k) {
+            string name = k < names.size() ? names[k] : to_string(k);
+            refs.push_back({ pool.size(), name.size() });
+            pool += name;
+        }
+        size_t blocks = n / 64 + 1;
+        size_t samples = 0;
+        for (size_t i = 0; i < n; ++i) samples += (sa[i] % sampleRate == 0);
+        const size_t sizes[SECTION_COUNT] = {
+            blocks * sizeof(Block), blocks * sizeof(SampleWord), samples * sizeof(uint32_t),
+            starts.size() * sizeof(uint64_t), refs.size() * sizeof(StrRef), pool.size()
+        };
+        Header h{};
+        memcpy(h.magic, MAGIC, 8);
+        h.version = VERSION;
+        h.byteOrder = 0x01020304;
+        h.length = n;
+        h.sampleRate = sampleRate;
+        h.sequences = starts.size();
+        uint64_t offset = (sizeof(Header) + 7) & ~uint64_t(7);
+        for (size_t s = 0; s < SECTION_COUNT; ++s) {
+            h.sections[s] = { offset, sizes[s] };
+            offset = (offset + sizes[s] + 7) & ~uint64_t(7);
+        }
+        h.bytes = offset;
+        image.assign(offset / 8, 0);
+        base = reinterpret_cast<const char*>(image.data());
+        char* out = reinterpret_cast<char*>(image.data());
+
+        // BWT blocks and sampled rows in one pass over the suffix array
+        Block* bw = reinterpret_cast<Block*>(out + h.sections[BLOCKS].offset);
+        SampleWord* sw = reinterpret_cast<SampleWord*>(out + h.sections[SAMPLED].offset);
+        uint32_t* sv = reinterpret_cast<uint32_t*>(out + h.sections[SAMPLES].offset);
+        uint64_t occ[CODES] = {};
+        uint32_t running[5] = {};
+        size_t sampled = 0;
+        for (size_t i = 0; i < n; ++i) {
+            Block& b = bw[i >> 6];
+            SampleWord& w = sw[i >> 6];
+            if ((i & 63) == 0) {
+                memcpy(b.before, running, sizeof(running));
+                w.before = sampled;
+            }
+            uint64_t bit = uint64_t(1) << (i & 63);
+            uint8_t c = text[sa[i] ? sa[i] - 1 : n - 1];
+            ++occ[c];
+            if (c == SENTINEL || c == SEPARATOR) {
+                b.special |= bit;
+                ++running[4];
+                if (c == SENTINEL) h.sentinelRow = i;
+            } else {
+                if ((c - 1) & 1) b.lo |= bit;
+                if ((c - 1) & 2) b.hi |= bit;
+                ++running[c - 1];
+            }
+            if (sa[i] % sampleRate == 0) {
+                w.bits |= bit;
+                sv[sampled++] = sa[i];
+            }
+        }
+        if (n % 64 == 0) {
+            memcpy(bw[n >> 6].before, running, sizeof(running));
+            sw[n >> 6].before = sampled;
+        }
+        for (size_t c = 1; c < CODES; ++c) h.C[c] = h.C[c - 1] + occ[c - 1];
+
+        memcpy(out + h.sections[STARTS].offset, starts.data(), sizes[STARTS]);
+        memcpy(out + h.sections[NAME_REFS].offset, refs.data(), sizes[NAME_REFS]);
+        memcpy(out + h.sections[NAMES].offset, pool.data(), sizes[NAMES]);
+        memcpy(out, &h, sizeof(h));
+        header = reinterpret_cast<const Header*>(base);
+    }
+
+    void validate(const string& path) const {
+        auto fail = [&path](const string& why) {
+            throw runtime_error("FMIndex: " + path + ": " + why);
+        };
+        if (mapSize < sizeof(Header) || memcmp(header->magic, MAGIC, 8) != 0) fail("not an FM-index");
+        if (header->byteOrder != 0x01020304) fail("written with a different byte order");
+        if (header->version != VERSION) fail("unsupported version " + to_string(header->version));
+        if (header->bytes != mapSize) fail("truncated");
+        for (const SectionRef& s : header->sections)
+            if (s.offset % 8 || s.offset > mapSize || s.size > mapSize - s.offset) fail("section out of range");
+        size_t blocks = header->length / 64 + 1;
+        if (header->length == 0 || header->sampleRate == 0 || header->sequences == 0
+            || header->sections[BLOCKS].size != blocks * sizeof(Block)
+            || header->sections[SAMPLED].size != blocks * sizeof(SampleWord)
+            || header->sections[STARTS].size != header->sequences * sizeof(uint64_t)
+            || header->sections[NAME_REFS].size != header->sequences * sizeof(StrRef))
+            fail("inconsistent sections");
+    }
+
+public:
+    // Indexes sequences in order; hits report their position in the vector
+    explicit FMIndex(const vector<const NucleotideSequence*>& seqs, const vector<string>& names = {},
+                     uint32_t sampleRate = 32) {
+        build(seqs.size(), [&](auto&& add) {
+            for (const NucleotideSequence* s : seqs)
+                add([s](auto&& chunk) {
+                    if (s->isView()) {
+                        s->view().forEachChunk(chunk);
+                    } else {
+                        string part;
+                        for (size_t pos = 0; pos < s->length(); pos += 1 << 20) {
+                            part = s->substr(pos, 1 << 20);
+                            chunk(part.data(), part.size());
+                        }
+                    }
+                });
+        }, names, sampleRate);
+    }
+
+    // Whole reference, one sequence per FASTA record
+    explicit FMIndex(const ReferenceStore& ref, uint32_t sampleRate = 32) {
+        vector<string> names;
+        for (const ReferenceStore::FaiEntry& e : ref.index()) names.push_back(e.name);
+        build(names.size(), [&](auto&& add) {
+            for (const string& name : names) {
+                RefView v = ref.view(name, 0, validation::npos);
+                add([&v](auto&& chunk) { v.forEachChunk(chunk); });
+            }
+        }, names, sampleRate);
+    }
+
+    // Maps an index written by save(); nothing is decoded up front
+    explicit FMIndex(const string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("FMIndex: cannot open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); throw runtime_error("FMIndex: cannot stat " + path); }
+        mapSize = static_cast<size_t>(st.st_size);
+        if (mapSize < sizeof(Header)) { ::close(fd); throw runtime_error("FMIndex: " + path + ": not an FM-index"); }
+
+        void* m = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) { ::close(fd); throw runtime_error("FMIndex: cannot mmap " + path); }
+        map = base = static_cast<const char*>(m);
+        header = reinterpret_cast<const Header*>(map);
+
+        try {
+            validate(path);
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    FMIndex(const FMIndex&) = delete;
+    FMIndex& operator=(const FMIndex&) = delete;
+
+    ~FMIndex() {
+        release();
+    }
+
+    void release() {
+        if (map) munmap(const_cast<char*>(map), mapSize);
+        if (fd >= 0) ::close(fd);
+        map = nullptr;
+        fd = -1;
+    }
+
+    void save(const string& path) const {
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("FMIndex: cannot create " + path);
+        out.write(base, header->bytes);
+        if (!out) throw runtime_error("FMIndex: write failed for " + path);
+    }
+
+    size_t sequenceCount() const { return header->sequences; }
+    size_t sampleRate() const { return header->sampleRate; }
+    size_t memoryUsage() const { return header->bytes; }
+
+    string_view sequenceName(size_t k) const {
+        const StrRef& r = column<StrRef>(NAME_REFS)[k];
+        return string_view(column<char>(NAMES) + r.offset, r.len);
+    }
+
+    size_t sequenceLength(size_t k) const {
+        const uint64_t* starts = column<uint64_t>(STARTS);
+        size_t end = (k + 1 < header->sequences) ? starts[k + 1] - 1 : header->length - 1;
+        return end - starts[k];
+    }
+
+    // Backward search; empty for an empty pattern or one with non-ACGT symbols
+    Range range(string_view pattern) const {
+        const array<uint8_t, 256>& table = codeTable();
+        if (pattern.empty()) return {};
+        Range r{ 0, header->length };
+        for (size_t i = pattern.size(); i-- > 0 && !r.empty(); ) {
+            uint8_t c = table[static_cast<unsigned char>(pattern[i])];
+            if (c == SEPARATOR) return {};
+            r.lo = header->C[c] + rank(c - 1, r.lo);
+            r.hi = header->C[c] + rank(c - 1, r.hi);
+        }
+        return r.empty() ? Range{} : r;
+    }
+
+    size_t count(string_view pattern) const {
+        return range(pattern).count();
+    }
+
+    // Sorted hits, at most limit of them (which ones is unspecified)
+    vector<Hit> locate(string_view pattern, size_t limit = SIZE_MAX) const {
+        Range r = range(pattern);
+        vector<Hit> hits;
+        hits.reserve(min(r.count(), limit));
+        for (size_t row = r.lo; row < r.hi && hits.size() < limit; ++row)
+            hits.push_back(toHit(textPosition(row)));
+        sort(hits.begin(), hits.end());
+        return hits;
+    }
+
+    vector<size_t> countMany(const vector<string>& patterns,
+                             ThreadPool& pool = ThreadPool::shared()) const {
+        vector<size_t> out(patterns.size());
+        pool.parallelFor(patterns.size(), 256, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) out[i] = count(patterns[i]);
+        });
+        return out;
+    }
+
+    vector<vector<Hit>> locateMany(const vector<string>& patterns, size_t limit = SIZE_MAX,
+                                   ThreadPool& pool = ThreadPool::shared()) const {
+        vector<vector<Hit>> out(patterns.size());
+        pool.parallelFor(patterns.size(), 16, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) out[i] = locate(patterns[i], limit);
+        });
+        return out;
+    }
+};
+
+inline void NucleotideSequence::buildIndex(uint32_t sampleRate) {
+    fm = make_shared<const FMIndex>(vector<const NucleotideSequence*>{ this }, vector<string>{}, sampleRate);
+}
+
+inline void NucleotideSequence::attachIndex(shared_ptr<const FMIndex> index) {
+    if (index && (index->sequenceCount() != 1 || index->sequenceLength(0) != length()))
+        throw invalid_argument("NucleotideSequence: index was built over different bases");
+    fm = move(index);
+}
+
+inline size_t NucleotideSequence::countMotif(string_view motif) const {
+    if (fm) return fm->count(motif);
+    return findMotif(motif).size();
+}
+
+inline vector<size_t> NucleotideSequence::findMotif(string_view motif) const {
+    vector<size_t> out;
+    if (fm) {
+        for (const FMIndex::Hit& h : fm->locate(motif)) out.push_back(h.position);
+        return out;
+    }
+    // Fold both sides to upper-case DNA; other symbols never match
+    string needle(motif);
+    for (char& c : needle) {
+        c = char(toupper(static_cast<unsigned char>(c)));
+        if (c == 'U') c = 'T';
+        if (c != 'A' && c != 'C' && c != 'G' && c != 'T') return out;
+    }
+    if (needle.empty()) return out;
+    string text = str();
+    strand::toUpper(&text[0], text.size());
+    std::replace(text.begin(), text.end(), 'U', 'T');
+    for (size_t p = text.find(needle); p != string::npos; p = text.find(needle, p + 1))
+        out.push_back(p);
+    return out;
+}
+
+#endif  // LAB5_H